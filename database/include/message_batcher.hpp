@@ -0,0 +1,160 @@
+#pragma once
+
+#include "postgresql.hpp"
+#include <deque>
+#include <future>
+#include <thread>
+
+// Group commit for message inserts. insert() blocks the calling thread until
+// its row is committed, while one flusher thread turns everything queued in
+// the meantime into a single PostgresDatabase::insertMessages call.
+//
+// A batch is cut when maxBatch rows are waiting or maxDelay has passed since
+// its first row arrived. Rows that arrive while a commit is in flight wait
+// for the next batch, so bursts coalesce even with maxDelay = 0.
+//
+// If the server rejects a batch, its rows are retried one at a time so that
+// only the row at fault reports the error. Other failures, such as a lost
+// connection or a pool timeout, go to every caller in the batch.
+class MessageBatcher {
+public:
+    struct Stats {
+        uint64_t batches;
+        uint64_t rows;
+        uint64_t largestBatch;
+        uint64_t failedBatches;
+    };
+
+    MessageBatcher(PostgresDatabase& db, size_t maxBatch, std::chrono::microseconds maxDelay)
+        : db(db), maxBatch(maxBatch < 1 ? 1 : maxBatch), maxDelay(maxDelay),
+          running(true), batches(0), rows(0), largestBatch(0), failedBatches(0) {
+        flusher = std::thread(&MessageBatcher::run, this);
+    }
+
+    ~MessageBatcher() {
+        stop();
+    }
+
+    MessageBatcher(const MessageBatcher&) = delete;
+    MessageBatcher& operator=(const MessageBatcher&) = delete;
+
+    // Returns the committed message id; rethrows the error if this row
+    // could not be inserted.
+    int insert(PostgresDatabase::NewMessage message) {
+        std::future<int> id;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) {
+                throw std::runtime_error("[PSQL.Batcher] stopped");
+            }
+            queue.push_back(Pending{std::move(message), std::promise<int>(), std::chrono::steady_clock::now()});
+            id = queue.back().id.get_future();
+        }
+        cv.notify_one();
+        return id.get();
+    }
+
+    // Commits whatever is queued, then joins the flusher.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) {
+                return;
+            }
+            running = false;
+        }
+        cv.notify_one();
+        if (flusher.joinable()) {
+            flusher.join();
+        }
+    }
+
+    Stats stats() const {
+        return Stats{batches.load(), rows.load(), largestBatch.load(), failedBatches.load()};
+    }
+
+private:
+    struct Pending {
+        PostgresDatabase::NewMessage message;
+        std::promise<int> id;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
+    PostgresDatabase& db;
+    const size_t maxBatch;
+    const std::chrono::microseconds maxDelay;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Pending> queue;
+    bool running;
+    std::thread flusher;
+
+    std::atomic<uint64_t> batches;
+    std::atomic<uint64_t> rows;
+    std::atomic<uint64_t> largestBatch;
+    std::atomic<uint64_t> failedBatches;
+
+    void run() {
+        std::vector<Pending> batch;
+        std::vector<PostgresDatabase::NewMessage> messages;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return !queue.empty() || !running; });
+                if (queue.empty()) {
+                    return;
+                }
+
+                const auto deadline = queue.front().queuedAt + maxDelay;
+                cv.wait_until(lock, deadline, [this] { return queue.size() >= maxBatch || !running; });
+
+                const size_t take = std::min(queue.size(), maxBatch);
+                batch.clear();
+                for (size_t i = 0; i < take; ++i) {
+                    batch.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+            }
+
+            messages.clear();
+            for (auto& pending : batch) {
+                messages.push_back(std::move(pending.message));
+            }
+
+            try {
+                std::vector<int> ids = db.insertMessages(messages);
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    batch[i].id.set_value(ids[i]);
+                }
+            } catch (const pqxx::sql_error&) {
+                failedBatches++;
+                insertOneByOne(batch, messages);
+            } catch (...) {
+                failedBatches++;
+                for (auto& pending : batch) {
+                    pending.id.set_exception(std::current_exception());
+                }
+            }
+
+            batches++;
+            rows += batch.size();
+            if (batch.size() > largestBatch) {
+                largestBatch = batch.size();
+            }
+        }
+    }
+
+    void insertOneByOne(std::vector<Pending>& batch, std::vector<PostgresDatabase::NewMessage>& messages) {
+        std::vector<PostgresDatabase::NewMessage> one(1);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            one[0] = std::move(messages[i]);
+            try {
+                batch[i].id.set_value(db.insertMessages(one).front());
+            } catch (...) {
+                batch[i].id.set_exception(std::current_exception());
+            }
+        }
+    }
+};
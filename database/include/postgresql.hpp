@@ -1,20 +1,47 @@
+#pragma once
+
 #include <pqxx/pqxx>
 #include <iostream>
 #include <string>
 #include <vector>
+#include <array>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <initializer_list>
+#include <optional>
+#include <string_view>
+#include <cstddef>
 
 class PostgresConnection {
 public:
-    PostgresConnection(const std::string& connstr) : connection(nullptr) {
+    using SetupFn = std::function<void(pqxx::connection&)>;
+
+    PostgresConnection(const std::string& connstr, SetupFn setup = nullptr)
+        : connstr(connstr), setup(std::move(setup)), connection(nullptr) {
         try {
             connection = new pqxx::connection(connstr);
             if (connection->is_open()) {
                 std::cout << "[PSQL.Connection] Successfully connected to PostgreSQL database" << std::endl;
             }
+            if (this->setup) {
+                this->setup(*connection);
+            }
         } catch (const std::exception& e) {
             std::cerr << "[PSQL.Connection] error: " << e.what() << std::endl;
+            delete connection;
             throw;
         }
+        lastUsed = std::chrono::steady_clock::now();
     }
 
     ~PostgresConnection() {
@@ -23,6 +50,9 @@ public:
         }
     }
 
+    PostgresConnection(const PostgresConnection&) = delete;
+    PostgresConnection& operator=(const PostgresConnection&) = delete;
+
     pqxx::connection* getConnection() const {
         return connection;
     }
@@ -31,25 +61,654 @@ public:
         return connection && connection->is_open();
     }
 
+    // Replaces a broken connection with a fresh one to the same server.
+    void reconnect() {
+        std::unique_ptr<pqxx::connection> fresh(new pqxx::connection(connstr));
+        if (setup) {
+            setup(*fresh);
+        }
+        delete connection;
+        connection = fresh.release();
+        lastUsed = std::chrono::steady_clock::now();
+        std::cout << "[PSQL.Connection] Reconnected to PostgreSQL database" << std::endl;
+    }
+
+    // Cheap round trip used to catch connections the server has dropped.
+    bool ping() {
+        try {
+            pqxx::nontransaction txn(*connection);
+            txn.exec("SELECT 1");
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+
+    void touch() {
+        lastUsed = std::chrono::steady_clock::now();
+    }
+
+    std::chrono::steady_clock::duration idleFor() const {
+        return std::chrono::steady_clock::now() - lastUsed;
+    }
+
 private:
+    std::string connstr;
+    SetupFn setup;
     pqxx::connection* connection;
+    std::chrono::steady_clock::time_point lastUsed;
+};
+
+// Fixed set of PostgresConnection objects shared by all callers. A Lease hands
+// one connection to exactly one thread and returns it to the pool when it goes
+// out of scope; broken or long-idle connections are checked before handout.
+class PostgresConnectionPool {
+public:
+    struct Stats {
+        size_t size;
+        size_t idle;
+        uint64_t checkouts;
+        uint64_t waits;
+        uint64_t timeouts;
+        uint64_t reconnects;
+        uint64_t totalWaitMicros;
+        uint64_t maxWaitMicros;
+    };
+
+    class Lease {
+    public:
+        Lease(PostgresConnectionPool* pool, PostgresConnection* conn) : pool(pool), conn(conn) {}
+
+        Lease(Lease&& other) noexcept : pool(other.pool), conn(other.conn) {
+            other.conn = nullptr;
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease& operator=(Lease&&) = delete;
+
+        ~Lease() {
+            if (conn) {
+                pool->release(conn);
+            }
+        }
+
+        pqxx::connection& operator*() const {
+            return *conn->getConnection();
+        }
+
+        pqxx::connection* operator->() const {
+            return conn->getConnection();
+        }
+
+    private:
+        PostgresConnectionPool* pool;
+        PostgresConnection* conn;
+    };
+
+    PostgresConnectionPool(const std::string& connstr, size_t size,
+                           PostgresConnection::SetupFn setup = nullptr,
+                           std::chrono::milliseconds acquireTimeout = std::chrono::milliseconds(5000))
+        : acquireTimeout(acquireTimeout), healthy(false), checkouts(0), waits(0), timeouts(0),
+          reconnects(0), totalWaitMicros(0), maxWaitMicros(0) {
+        if (size == 0) {
+            size = 1;
+        }
+        for (size_t i = 0; i < size; ++i) {
+            connections.push_back(std::make_unique<PostgresConnection>(connstr, setup));
+            idle.push_back(connections.back().get());
+        }
+        healthy = connections.front()->isConnected();
+    }
+
+    PostgresConnectionPool(const PostgresConnectionPool&) = delete;
+    PostgresConnectionPool& operator=(const PostgresConnectionPool&) = delete;
+
+    Lease acquire() {
+        const auto start = std::chrono::steady_clock::now();
+        PostgresConnection* conn = nullptr;
+        bool waited = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (idle.empty()) {
+                waited = true;
+                if (!available.wait_for(lock, acquireTimeout, [this] { return !idle.empty(); })) {
+                    ++timeouts;
+                    throw std::runtime_error("[PSQL.Pool] Timed out waiting for a database connection");
+                }
+            }
+            conn = idle.back();
+            idle.pop_back();
+        }
+
+        ++checkouts;
+        if (waited) {
+            const uint64_t micros = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count());
+            ++waits;
+            totalWaitMicros += micros;
+            uint64_t prevMax = maxWaitMicros.load();
+            while (micros > prevMax && !maxWaitMicros.compare_exchange_weak(prevMax, micros)) {}
+        }
+
+        if (!ensureHealthy(conn)) {
+            release(conn);
+            throw std::runtime_error("[PSQL.Database] Database not connected");
+        }
+        return Lease(this, conn);
+    }
+
+    bool isConnected() const {
+        return healthy;
+    }
+
+    Stats stats() const {
+        Stats s{};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            s.idle = idle.size();
+        }
+        s.size = connections.size();
+        s.checkouts = checkouts;
+        s.waits = waits;
+        s.timeouts = timeouts;
+        s.reconnects = reconnects;
+        s.totalWaitMicros = totalWaitMicros;
+        s.maxWaitMicros = maxWaitMicros;
+        return s;
+    }
+
+private:
+    static constexpr std::chrono::seconds kIdlePingAfter{30};
+
+    std::vector<std::unique_ptr<PostgresConnection>> connections;
+    std::vector<PostgresConnection*> idle;
+    mutable std::mutex mutex;
+    std::condition_variable available;
+    std::chrono::milliseconds acquireTimeout;
+
+    std::atomic<bool> healthy;
+    std::atomic<uint64_t> checkouts;
+    std::atomic<uint64_t> waits;
+    std::atomic<uint64_t> timeouts;
+    std::atomic<uint64_t> reconnects;
+    std::atomic<uint64_t> totalWaitMicros;
+    std::atomic<uint64_t> maxWaitMicros;
+
+    bool ensureHealthy(PostgresConnection* conn) {
+        bool ok = conn->isConnected();
+        if (ok && conn->idleFor() > kIdlePingAfter) {
+            ok = conn->ping();
+        }
+        if (!ok) {
+            try {
+                conn->reconnect();
+                ++reconnects;
+                ok = true;
+            } catch (const std::exception& e) {
+                std::cerr << "[PSQL.Pool] Reconnect failed: " << e.what() << std::endl;
+            }
+        }
+        healthy = ok;
+        return ok;
+    }
+
+    void release(PostgresConnection* conn) {
+        conn->touch();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.push_back(conn);
+        }
+        available.notify_one();
+    }
+};
+
+// Streaming replicas of the primary that can serve reads. A monitor thread
+// samples pg_current_wal_lsn() on the primary and pg_last_wal_replay_lsn()
+// on every replica each pollInterval.
+//
+// noteWrite() marks the users a commit affected. Their next reads go to the
+// primary until a sample taken after the write fixes the LSN they need, then
+// to any replica that has replayed that far. Replicas more than maxLagBytes
+// behind, or whose sample has gone stale, are skipped for everyone. The
+// monitor forgets a write once every healthy replica has replayed it; a
+// replica that recovers is skipped until it reaches the primary's LSN at
+// the time it came back.
+class ReplicaRouter {
+public:
+    struct Options {
+        size_t poolSize = 4;
+        std::chrono::milliseconds pollInterval{20};
+        uint64_t maxLagBytes = 16 * 1024 * 1024;
+    };
+
+    struct Stats {
+        size_t replicas;
+        size_t usable;          // healthy and within maxLagBytes at the last sample
+        uint64_t replicaReads;
+        uint64_t primaryReads;
+        uint64_t lagFallbacks;  // reads sent to the primary because no replica had caught up
+    };
+
+    ReplicaRouter(PostgresConnectionPool& primary, const std::vector<std::string>& connstrs,
+                  PostgresConnection::SetupFn setup, Options options)
+        : primary(primary), options(options), running(false), pollEpoch(0),
+          next(0), replicaReads(0), primaryReads(0), lagFallbacks(0) {
+        for (const auto& connstr : connstrs) {
+            try {
+                replicas.push_back(std::make_unique<Replica>());
+                replicas.back()->pool = std::make_unique<PostgresConnectionPool>(connstr, options.poolSize, setup);
+            } catch (const std::exception& e) {
+                // The replica stays in the list, unusable, so indexes in logs
+                // keep matching the configuration.
+                std::cerr << "[PSQL.Replicas] replica " << replicas.size() - 1
+                          << " unavailable: " << e.what() << std::endl;
+            }
+        }
+        if (!replicas.empty()) {
+            running = true;
+            monitor = std::thread(&ReplicaRouter::run, this);
+        }
+    }
+
+    ~ReplicaRouter() {
+        stop();
+    }
+
+    ReplicaRouter(const ReplicaRouter&) = delete;
+    ReplicaRouter& operator=(const ReplicaRouter&) = delete;
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) {
+                return;
+            }
+            running = false;
+        }
+        wake.notify_one();
+        if (monitor.joinable()) {
+            monitor.join();
+        }
+    }
+
+    bool enabled() const {
+        return !replicas.empty();
+    }
+
+    // Pool to read from for userId; 0 means the read does not depend on any
+    // one user's writes. Takes no lock shared by every reader: the replica
+    // state comes from the monitor's latest published sample, and only the
+    // user's own shard of pending writes is locked.
+    PostgresConnectionPool& poolFor(int userId) {
+        if (replicas.empty()) {
+            return primary;
+        }
+
+        std::shared_ptr<const Sample> sample;
+        uint64_t required = 0;
+        if (userId > 0) {
+            WriteShard& shard = writeShardFor(userId);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            // Loaded under the shard lock: an entry the monitor has dropped
+            // was dropped after the sample that allowed it was published.
+            sample = std::atomic_load(&latest);
+            auto it = shard.writes.find(userId);
+            if (it != shard.writes.end()) {
+                if (it->second.lsn == 0) {
+                    if (!sample || sample->epoch <= it->second.epoch) {
+                        primaryReads.fetch_add(1, std::memory_order_relaxed);
+                        return primary;
+                    }
+                    it->second.lsn = sample->primaryLsn;
+                }
+                required = it->second.lsn;
+            }
+        } else {
+            sample = std::atomic_load(&latest);
+        }
+
+        const auto staleAfter = std::max<std::chrono::steady_clock::duration>(
+            options.pollInterval * 10, std::chrono::seconds(1));
+        if (sample && std::chrono::steady_clock::now() - sample->sampledAt <= staleAfter) {
+            const size_t start = next.fetch_add(1, std::memory_order_relaxed);
+            for (size_t i = 0; i < replicas.size(); ++i) {
+                const size_t index = (start + i) % replicas.size();
+                const ReplicaState& state = sample->replicas[index];
+                if (state.usable && state.replayLsn >= required) {
+                    replicaReads.fetch_add(1, std::memory_order_relaxed);
+                    return *replicas[index]->pool;
+                }
+            }
+        }
+        lagFallbacks.fetch_add(1, std::memory_order_relaxed);
+        primaryReads.fetch_add(1, std::memory_order_relaxed);
+        return primary;
+    }
+
+    // Call after a commit on the primary that changed what these users read.
+    void noteWrite(std::initializer_list<int> userIds) {
+        if (replicas.empty()) {
+            return;
+        }
+        const uint64_t epoch = pollEpoch.load();
+        for (int userId : userIds) {
+            WriteShard& shard = writeShardFor(userId);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.writes[userId] = Write{epoch, 0};
+        }
+    }
+
+    Stats stats() const {
+        std::shared_ptr<const Sample> sample = std::atomic_load(&latest);
+        return Stats{replicas.size(), sample ? sample->usable : 0,
+                     replicaReads.load(std::memory_order_relaxed),
+                     primaryReads.load(std::memory_order_relaxed),
+                     lagFallbacks.load(std::memory_order_relaxed)};
+    }
+
+    // "16/B374D848" -> 0x16B374D848; 0 for NULL or malformed input.
+    static uint64_t parseLsn(const std::string& text) {
+        const size_t slash = text.find('/');
+        if (slash == std::string::npos) {
+            return 0;
+        }
+        try {
+            return (std::stoull(text.substr(0, slash), nullptr, 16) << 32) |
+                   std::stoull(text.substr(slash + 1), nullptr, 16);
+        } catch (const std::exception&) {
+            return 0;
+        }
+    }
+
+private:
+    // healthy, replayLsn and catchUpTo belong to the monitor thread; readers
+    // see them only through a published Sample.
+    struct Replica {
+        std::unique_ptr<PostgresConnectionPool> pool;
+        bool healthy = false;
+        uint64_t replayLsn = 0;
+        uint64_t catchUpTo = 0; // primary LSN when it last became healthy
+    };
+
+    struct ReplicaState {
+        bool usable;
+        uint64_t replayLsn;
+    };
+
+    // One poll's view of the primary and every replica, replaced whole
+    // after each poll and never modified once published.
+    struct Sample {
+        uint64_t epoch;
+        uint64_t primaryLsn;
+        std::chrono::steady_clock::time_point sampledAt;
+        std::vector<ReplicaState> replicas;
+        size_t usable;
+    };
+
+    // epoch is the poll that was running when the write committed; the LSN
+    // is filled in from the first sample of a later poll.
+    struct Write {
+        uint64_t epoch;
+        uint64_t lsn;
+    };
+
+    static constexpr size_t kWriteShards = 16;
+
+    struct WriteShard {
+        std::mutex mutex;
+        std::unordered_map<int, Write> writes;
+    };
+
+    PostgresConnectionPool& primary;
+    const Options options;
+    std::vector<std::unique_ptr<Replica>> replicas;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running;
+    std::thread monitor;
+
+    std::atomic<uint64_t> pollEpoch;
+    std::shared_ptr<const Sample> latest; // std::atomic_load/atomic_store only
+    std::array<WriteShard, kWriteShards> writeShards;
+    std::atomic<size_t> next;
+
+    std::atomic<uint64_t> replicaReads;
+    std::atomic<uint64_t> primaryReads;
+    std::atomic<uint64_t> lagFallbacks;
+
+    WriteShard& writeShardFor(int userId) {
+        return writeShards[static_cast<size_t>(userId) % kWriteShards];
+    }
+
+    bool usable(const Replica& replica, uint64_t primaryLsn) const {
+        return replica.healthy && replica.replayLsn >= replica.catchUpTo &&
+               (primaryLsn <= replica.replayLsn || primaryLsn - replica.replayLsn <= options.maxLagBytes);
+    }
+
+    static uint64_t sampleLsn(PostgresConnectionPool& pool, const char* query) {
+        auto conn = pool.acquire();
+        pqxx::nontransaction txn(*conn);
+        pqxx::result res = txn.exec(query);
+        if (res.empty() || res[0][0].is_null()) {
+            return 0;
+        }
+        return parseLsn(res[0][0].as<std::string>());
+    }
+
+    void run() {
+        std::vector<uint64_t> replayLsns(replicas.size());
+        uint64_t sampleEpoch = 0;
+        uint64_t primaryLsn = 0;
+        std::chrono::steady_clock::time_point sampledAt;
+        while (true) {
+            const uint64_t epoch = ++pollEpoch;
+
+            uint64_t lsn = 0;
+            try {
+                lsn = sampleLsn(primary, "SELECT pg_current_wal_lsn()::text");
+            } catch (const std::exception& e) {
+                std::cerr << "[PSQL.Replicas] primary LSN sample failed: " << e.what() << std::endl;
+            }
+            for (size_t i = 0; i < replicas.size(); ++i) {
+                replayLsns[i] = 0;
+                if (!replicas[i]->pool) {
+                    continue;
+                }
+                try {
+                    // NULL (parsed as 0) when the server is not in recovery.
+                    replayLsns[i] = sampleLsn(*replicas[i]->pool, "SELECT pg_last_wal_replay_lsn()::text");
+                } catch (const std::exception& e) {
+                    std::cerr << "[PSQL.Replicas] replica " << i << " LSN sample failed: " << e.what() << std::endl;
+                }
+            }
+
+            if (lsn > 0) {
+                primaryLsn = lsn;
+                sampleEpoch = epoch;
+                sampledAt = std::chrono::steady_clock::now();
+            }
+            auto sample = std::make_shared<Sample>();
+            sample->epoch = sampleEpoch;
+            sample->primaryLsn = primaryLsn;
+            sample->sampledAt = sampledAt;
+            sample->replicas.reserve(replicas.size());
+            sample->usable = 0;
+            uint64_t minReplay = std::numeric_limits<uint64_t>::max();
+            for (size_t i = 0; i < replicas.size(); ++i) {
+                Replica& replica = *replicas[i];
+                const bool healthy = replayLsns[i] > 0;
+                if (healthy && !replica.healthy) {
+                    // Entries may have expired while it was down; it serves
+                    // nobody until it has replayed everything they covered.
+                    replica.catchUpTo = primaryLsn;
+                }
+                replica.healthy = healthy;
+                replica.replayLsn = replayLsns[i];
+                if (healthy) {
+                    minReplay = std::min(minReplay, replica.replayLsn);
+                }
+                const bool ok = usable(replica, primaryLsn);
+                sample->replicas.push_back(ReplicaState{ok, replica.replayLsn});
+                sample->usable += ok ? 1 : 0;
+            }
+            std::atomic_store(&latest, std::shared_ptr<const Sample>(std::move(sample)));
+
+            // Fix the LSN of writes this sample covers whether or not their
+            // users read again, and drop users every replica has caught up
+            // with, so the maps hold only writes still in flight. This runs
+            // after the sample is published, so a reader that finds its
+            // entry gone also sees a sample that covers it.
+            for (WriteShard& shard : writeShards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                for (auto it = shard.writes.begin(); it != shard.writes.end();) {
+                    if (it->second.lsn == 0 && sampleEpoch > it->second.epoch) {
+                        it->second.lsn = primaryLsn;
+                    }
+                    if (it->second.lsn != 0 && it->second.lsn <= minReplay) {
+                        it = shard.writes.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, options.pollInterval, [this] { return !running; });
+            if (!running) {
+                return;
+            }
+        }
+    }
 };
 
 class PostgresDatabase {
 
 public:
-    PostgresDatabase(const std::string& connstr) : pgConn(connstr) {}
+    PostgresDatabase(const std::string& connstr, size_t poolSize = 4,
+                     const std::vector<std::string>& replicaConnstrs = {},
+                     ReplicaRouter::Options replicaOptions = ReplicaRouter::Options())
+        : pool(connstr, poolSize, &PostgresDatabase::prepareStatements),
+          replicas(pool, replicaConnstrs, &PostgresDatabase::prepareStatements, replicaOptions) {}
+
+    // Registers every statement this class runs on a freshly opened
+    // connection, so Postgres parses and plans each one once per session.
+    static void prepareStatements(pqxx::connection& c) {
+        c.prepare("create_user",
+            "INSERT INTO users (username) VALUES ($1) RETURNING id");
+        c.prepare("get_user_by_username",
+            "SELECT id, username FROM users WHERE username = $1");
+        c.prepare("get_user_by_id",
+            "SELECT id, username FROM users WHERE id = $1");
+        c.prepare("create_user_with_password",
+            "INSERT INTO users (username, password_hash) VALUES ($1, $2) RETURNING id");
+        c.prepare("get_user_credentials",
+            "SELECT id, username, password_hash FROM users WHERE username = $1");
+        c.prepare("insert_message", withChatSummary(
+            "INSERT INTO messages (sender_id, receiver_id, body, is_read) VALUES ($1, $2, $3, FALSE)"));
+        c.prepare("insert_message_e2e", withChatSummary(
+            "INSERT INTO messages (sender_id, receiver_id, body, e2e_payload, e2e_pub, is_read) "
+            "VALUES ($1, $2, $3, $4, $5, FALSE)"));
+        // Group-commit insert: one row per array element. Rows go in in
+        // array order, so the serial ids come out ascending in that order.
+        // E2E payloads arrive as one binary bytea ($7) with each row's
+        // 1-based start and length; rows without one have NULL for both.
+        c.prepare("insert_messages_batch", withChatSummary(
+            "INSERT INTO messages (sender_id, receiver_id, body, e2e_payload, e2e_pub, is_read) "
+            "SELECT t.sender_id, t.receiver_id, t.body, "
+            "       substring($7::bytea FROM t.payload_at FOR t.payload_len), t.e2e_pub, FALSE "
+            "FROM unnest($1::int[], $2::int[], $3::text[], $4::int[], $5::int[], $6::text[]) WITH ORDINALITY "
+            "     AS t(sender_id, receiver_id, body, payload_at, payload_len, e2e_pub, ord) "
+            "ORDER BY t.ord"));
+        c.prepare("get_user_profile",
+            "SELECT u.avatar_hash, a.mime AS avatar_mime, u.e2e_pub "
+            "FROM users u "
+            "LEFT JOIN avatars a ON a.hash = u.avatar_hash "
+            "WHERE u.username = $1");
+        // Bytes come back only when they differ from the hash the caller
+        // already holds ($2).
+        c.prepare("get_avatar",
+            "SELECT u.avatar_hash, a.mime, "
+            "  CASE WHEN u.avatar_hash IS DISTINCT FROM $2 THEN a.data END AS data "
+            "FROM users u "
+            "LEFT JOIN avatars a ON a.hash = u.avatar_hash "
+            "WHERE u.username = $1");
+        c.prepare("set_user_avatar", withAvatarStored(
+            "SELECT avatar_hash FROM updated"));
+        // SET_AVATAR also needs the partners to notify: one row per partner,
+        // or a single row with a NULL partner_id when there are none.
+        c.prepare("update_avatar", withAvatarStored(
+            "SELECT u.avatar_hash, s.partner_id "
+            "FROM updated u "
+            "LEFT JOIN chat_summaries s ON s.user_id = $1"));
+        c.prepare("set_user_e2e_pub",
+            "UPDATE users SET e2e_pub = $2 WHERE id = $1");
+        // Applies a batch of read receipts: every message a reader got from a
+        // sender up to the given id. Unread counts drop by what was actually
+        // marked, so messages that arrived after up_to stay counted.
+        c.prepare("mark_messages_read_upto",
+            "WITH receipts AS ("
+            "  SELECT * FROM unnest($1::int[], $2::int[], $3::int[]) AS r(reader_id, sender_id, up_to)"
+            "), marked AS ("
+            "  UPDATE messages m SET is_read = TRUE "
+            "  FROM receipts r "
+            "  WHERE m.receiver_id = r.reader_id "
+            "  AND m.sender_id = r.sender_id "
+            "  AND m.id <= r.up_to "
+            "  AND m.is_read = FALSE "
+            "  RETURNING m.receiver_id, m.sender_id"
+            "), counts AS ("
+            "  SELECT receiver_id, sender_id, COUNT(*) AS n FROM marked GROUP BY receiver_id, sender_id"
+            ") "
+            "UPDATE chat_summaries s SET unread_count = GREATEST(s.unread_count - c.n, 0) "
+            "FROM counts c "
+            "WHERE s.user_id = c.receiver_id AND s.partner_id = c.sender_id "
+            "RETURNING c.n");
+        c.prepare("delete_chat_messages",
+            "WITH deleted AS ("
+            "  DELETE FROM messages "
+            "  WHERE conversation_key = conversation_key_of($1, $2) "
+            "  RETURNING id"
+            "), cleared AS ("
+            "  DELETE FROM chat_summaries "
+            "  WHERE (user_id = $1 AND partner_id = $2) OR (user_id = $2 AND partner_id = $1)"
+            ") "
+            "SELECT id FROM deleted");
+        // Chat lists read chat_summaries, one row per partner, instead of
+        // aggregating the user's whole message history.
+        c.prepare("get_chats_for_user",
+            "SELECT u.username "
+            "FROM chat_summaries s "
+            "JOIN users u ON u.id = s.partner_id "
+            "WHERE s.user_id = $1 "
+            "ORDER BY u.username");
+        c.prepare("get_chats_with_unread_counts",
+            "SELECT u.username, s.unread_count, s.last_message_id, s.last_activity "
+            "FROM chat_summaries s "
+            "JOIN users u ON u.id = s.partner_id "
+            "WHERE s.user_id = $1 "
+            "ORDER BY u.username");
+        c.prepare("get_chats_by_recency",
+            "SELECT u.username, s.unread_count, s.last_message_id, s.last_activity "
+            "FROM chat_summaries s "
+            "JOIN users u ON u.id = s.partner_id "
+            "WHERE s.user_id = $1 "
+            "ORDER BY s.last_activity DESC, s.last_message_id DESC");
+        c.prepare("maintain_message_partitions",
+            "SELECT create_message_partitions(NOW(), NOW() + make_interval(months => $1)) AS created, "
+            "       drop_expired_message_partitions() AS dropped");
+        c.prepare("set_message_retention",
+            "UPDATE message_retention "
+            "SET keep = CASE WHEN $1 > 0 THEN make_interval(days => $1) END");
+    }
 
     int createUser(const std::string& username) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+        auto conn = pool.acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "INSERT INTO users (username) VALUES (" + txn.quote(username) + ") RETURNING id"
-            );
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("create_user", username);
             txn.commit();
 
             if (res.empty()) {
@@ -64,15 +723,11 @@ public:
     }
 
     pqxx::result getUserByUsername(const std::string& username) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+        auto conn = pool.acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "SELECT id, username FROM users WHERE username = " + txn.quote(username)
-            );
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("get_user_by_username", username);
             txn.commit();
             return res;
         } catch (const std::exception& e) {
@@ -82,15 +737,11 @@ public:
     }
 
     pqxx::result getUserById(int userId) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+        auto conn = pool.acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "SELECT id, username FROM users WHERE id = " + txn.quote(userId)
-            );
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("get_user_by_id", userId);
             txn.commit();
             return res;
         } catch (const std::exception& e) {
@@ -100,16 +751,11 @@ public:
     }
 
     int createUserWithPassword(const std::string& username, const std::string& passwordHash) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+        auto conn = pool.acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "INSERT INTO users (username, password_hash) VALUES (" + 
-                txn.quote(username) + ", " + txn.quote(passwordHash) + ") RETURNING id"
-            );
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("create_user_with_password", username, passwordHash);
             txn.commit();
 
             if (res.empty()) {
@@ -124,15 +770,11 @@ public:
     }
 
     pqxx::result getUserCredentials(const std::string& username) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+        auto conn = pool.acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "SELECT id, username, password_hash FROM users WHERE username = " + txn.quote(username)
-            );
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("get_user_credentials", username);
             txn.commit();
             return res;
         } catch (const std::exception& e) {
@@ -142,22 +784,25 @@ public:
     }
 
     bool isConnected() const {
-        return pgConn.isConnected();
+        return pool.isConnected();
+    }
+
+    PostgresConnectionPool::Stats poolStats() const {
+        return pool.stats();
+    }
+
+    ReplicaRouter::Stats replicaStats() const {
+        return replicas.stats();
     }
 
     int insertMessage(int senderId, int receiverId, const std::string& body) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+        auto conn = pool.acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "INSERT INTO messages (sender_id, receiver_id, body, is_read) VALUES (" +
-                txn.quote(senderId) + ", " + txn.quote(receiverId) + ", " + txn.quote(body) + ", FALSE) "
-                "RETURNING id"
-            );
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("insert_message", senderId, receiverId, body);
             txn.commit();
+            replicas.noteWrite({senderId, receiverId});
 
             if (res.empty()) {
                 return -1;
@@ -170,21 +815,83 @@ public:
         }
     }
 
-    int insertMessageE2e(int senderId, int receiverId, const std::string& body, const std::string& e2ePayload, const std::string& e2ePub) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
+    struct NewMessage {
+        int senderId;
+        int receiverId;
+        std::string body;
+        bool e2e;               // e2ePayload/e2ePub are NULL when false
+        std::string e2ePayload; // raw ciphertext
+        std::string e2ePub;
+    };
+
+    // Inserts every row in one statement and one commit. Returns the new ids
+    // in the same order as rows.
+    std::vector<int> insertMessages(const std::vector<NewMessage>& rows) {
+        if (rows.empty()) {
+            return {};
+        }
+
+        std::vector<std::string> senders, receivers, bodies, payloadAt, payloadLen, pubs;
+        std::vector<bool> nulls;
+        std::string payloads;
+        for (const auto& row : rows) {
+            senders.push_back(std::to_string(row.senderId));
+            receivers.push_back(std::to_string(row.receiverId));
+            bodies.push_back(row.body);
+            payloadAt.push_back(std::to_string(payloads.size() + 1));
+            payloadLen.push_back(std::to_string(row.e2ePayload.size()));
+            pubs.push_back(row.e2ePub);
+            nulls.push_back(!row.e2e);
+            if (row.e2e) {
+                payloads += row.e2ePayload;
+            }
         }
 
+        auto conn = pool.acquire();
+        try {
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("insert_messages_batch",
+                arrayLiteral(senders, {}, false), arrayLiteral(receivers, {}, false),
+                arrayLiteral(bodies, {}, true), arrayLiteral(payloadAt, nulls, false),
+                arrayLiteral(payloadLen, nulls, false), arrayLiteral(pubs, nulls, true),
+                pqxx::binary_cast(payloads));
+            txn.commit();
+            for (const auto& row : rows) {
+                replicas.noteWrite({row.senderId, row.receiverId});
+            }
+
+            if (res.size() != rows.size()) {
+                throw std::runtime_error("batch insert returned " + std::to_string(res.size()) +
+                                         " ids for " + std::to_string(rows.size()) + " rows");
+            }
+
+            // RETURNING order is not guaranteed, but ids are drawn in insert
+            // order, so sorting them restores the row order.
+            std::vector<int> ids;
+            ids.reserve(res.size());
+            for (auto row : res) {
+                ids.push_back(row["id"].as<int>());
+            }
+            std::sort(ids.begin(), ids.end());
+            return ids;
+        } catch (const std::exception& e) {
+            std::cerr << "[PSQL.Database] insertMessages error: " << e.what() << std::endl;
+            throw;
+        }
+    }
+
+    // The body column stays empty; the server never sees E2E plaintext.
+    // e2ePayload is the ciphertext itself and is bound as binary bytea.
+    int insertMessageE2e(int senderId, int receiverId, const std::string& e2ePayload, const std::string& e2ePub) {
+        auto conn = pool.acquire();
+
         try {
             const std::string emptyBody;
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "INSERT INTO messages (sender_id, receiver_id, body, e2e_payload, e2e_pub, is_read) VALUES (" +
-                txn.quote(senderId) + ", " + txn.quote(receiverId) + ", " + txn.quote(emptyBody) + ", " +
-                txn.quote(e2ePayload) + ", " + txn.quote(e2ePub) + ", FALSE) "
-                "RETURNING id"
-            );
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("insert_message_e2e", senderId, receiverId, emptyBody,
+                                                 pqxx::binary_cast(e2ePayload), e2ePub);
             txn.commit();
+            replicas.noteWrite({senderId, receiverId});
 
             if (res.empty()) {
                 return -1;
@@ -197,140 +904,224 @@ public:
         }
     }
 
-    pqxx::result getMessagesBetween(int userA, int userB, int limit = 50, int offset = 0) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+    // Keyset cursor for conversation pages; 0 means unset. With beforeId the
+    // page is the newest `limit` messages older than it, with afterId the
+    // oldest `limit` messages newer than it, and with neither the newest
+    // page. Rows always come back oldest first.
+    struct MessageCursor {
+        int beforeId = 0;
+        int afterId = 0;
+    };
+
+    // One row of a streamed conversation page. The views point into the
+    // stream's current line and are only valid during the callback.
+    // e2ePayload holds the raw ciphertext bytes.
+    struct MessageRowView {
+        int id;
+        int senderId;
+        bool isRead;
+        std::string_view body;
+        std::optional<std::string_view> e2ePayload;
+        std::optional<std::string_view> e2ePub;
+    };
+    using MessageRowFn = std::function<void(const MessageRowView&)>;
+
+    // Conversation pages are read over COPY and each row handed to onRow as
+    // it arrives, so a page is never held whole in a pqxx::result. Rows come
+    // oldest first. streamConversationPage takes a newest-first OFFSET page;
+    // the cursor form is preferred.
+    void streamMessagesBetween(int userA, int userB, int limit, const MessageCursor& cursor,
+                               const MessageRowFn& onRow) {
+        streamMessages(userA, conversationStreamQuery(userA, userB, limit, 0, cursor),
+                       "streamMessagesBetween", onRow);
+    }
+
+    void streamConversationPage(int userA, int userB, int limit, int offset, const MessageRowFn& onRow) {
+        streamMessages(userA, conversationStreamQuery(userA, userB, limit, offset, MessageCursor()),
+                       "streamConversationPage", onRow);
+    }
+
+    // avatar_hash, avatar_mime and e2e_pub; the avatar itself is fetched
+    // separately with getAvatar. Reads are routed by ownerId, the user the
+    // profile belongs to, so whoever asks sees that user's latest writes.
+    pqxx::result getUserProfile(int ownerId, const std::string& username) {
+        auto conn = replicas.poolFor(ownerId).acquire();
 
-        pqxx::work txn(*pgConn.getConnection());
         try {
-            pqxx::result res = txn.exec(
-                "SELECT id, sender_id, receiver_id, body, created_at, is_read "
-                "FROM messages "
-                "WHERE (sender_id = " + txn.quote(userA) + " AND receiver_id = " + txn.quote(userB) + ") "
-                "   OR (sender_id = " + txn.quote(userB) + " AND receiver_id = " + txn.quote(userA) + ") "
-                "ORDER BY created_at ASC "
-                "LIMIT " + txn.quote(limit) + " OFFSET " + txn.quote(offset)
-            );
+            pqxx::read_transaction txn(*conn);
+            pqxx::result res = txn.exec_prepared("get_user_profile", username);
             txn.commit();
             return res;
         } catch (const std::exception& e) {
-            try { txn.abort(); } catch (...) {}
-            std::cerr << "[PSQL.Database] getMessagesBetween error: " << e.what() << std::endl;
+            std::cerr << "[PSQL.Database] getUserProfile error: " << e.what() << std::endl;
             throw;
         }
     }
 
-    pqxx::result getUserAvatarByUsername(const std::string& username) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+    // avatar_hash, mime and data (bytea) for the user's avatar; data is NULL
+    // when the avatar's hash equals cachedHash. Routed by ownerId as
+    // getUserProfile is.
+    pqxx::result getAvatar(int ownerId, const std::string& username, const std::string& cachedHash) {
+        auto conn = replicas.poolFor(ownerId).acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "SELECT avatar_b64, avatar_mime, e2e_pub FROM users WHERE username = " + txn.quote(username)
-            );
+            pqxx::read_transaction txn(*conn);
+            pqxx::result res = txn.exec_prepared("get_avatar", username, cachedHash);
             txn.commit();
             return res;
         } catch (const std::exception& e) {
-            std::cerr << "[PSQL.Database] getUserAvatarByUsername error: " << e.what() << std::endl;
+            std::cerr << "[PSQL.Database] getAvatar error: " << e.what() << std::endl;
             throw;
         }
     }
 
-    void setUserAvatar(int userId, const std::string& avatarB64, const std::string& avatarMime) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+    // Stores the raw image bytes in avatar; returns the content hash the
+    // user's avatar is now stored under.
+    std::string setUserAvatar(int userId, const std::string& avatar, const std::string& avatarMime) {
+        auto conn = pool.acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            txn.exec(
-                "UPDATE users SET avatar_b64 = " + txn.quote(avatarB64) + ", "
-                "avatar_mime = " + txn.quote(avatarMime) + " WHERE id = " + txn.quote(userId)
-            );
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("set_user_avatar", userId, pqxx::binary_cast(avatar), avatarMime);
             txn.commit();
+            replicas.noteWrite({userId});
+            return res.empty() ? "" : res[0]["avatar_hash"].as<std::string>();
         } catch (const std::exception& e) {
             std::cerr << "[PSQL.Database] setUserAvatar error: " << e.what() << std::endl;
             throw;
         }
     }
 
-    void setUserE2ePub(int userId, const std::string& e2ePub) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
+    struct AvatarUpdate {
+        std::string hash;
+        std::vector<int> partnerIds;
+    };
+
+    // SET_AVATAR's update and the partner lookup for its event, as one
+    // statement.
+    AvatarUpdate updateAvatar(int userId, const std::string& avatar, const std::string& avatarMime) {
+        auto conn = pool.acquire();
+
+        try {
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("update_avatar", userId, pqxx::binary_cast(avatar), avatarMime);
+            txn.commit();
+            replicas.noteWrite({userId});
+
+            AvatarUpdate update;
+            update.partnerIds.reserve(res.size());
+            for (auto row : res) {
+                update.hash = row["avatar_hash"].as<std::string>();
+                if (!row["partner_id"].is_null()) {
+                    update.partnerIds.push_back(row["partner_id"].as<int>());
+                }
+            }
+            return update;
+        } catch (const std::exception& e) {
+            std::cerr << "[PSQL.Database] updateAvatar error: " << e.what() << std::endl;
+            throw;
         }
+    }
+
+    void setUserE2ePub(int userId, const std::string& e2ePub) {
+        auto conn = pool.acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            txn.exec(
-                "UPDATE users SET e2e_pub = " + txn.quote(e2ePub) + " WHERE id = " + txn.quote(userId)
-            );
+            pqxx::work txn(*conn);
+            txn.exec_prepared("set_user_e2e_pub", userId, e2ePub);
             txn.commit();
+            replicas.noteWrite({userId});
         } catch (const std::exception& e) {
             std::cerr << "[PSQL.Database] setUserE2ePub error: " << e.what() << std::endl;
             throw;
         }
     }
 
-    void markMessagesRead(int receiverId, int senderId) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
+    struct ReadReceipt {
+        int readerId;
+        int senderId;
+        int upToId;
+    };
+
+    // Returns how many messages changed from unread to read.
+    int markMessagesReadUpTo(const std::vector<ReadReceipt>& receipts) {
+        if (receipts.empty()) {
+            return 0;
+        }
+
+        std::vector<std::string> readers, senders, upTo;
+        readers.reserve(receipts.size());
+        senders.reserve(receipts.size());
+        upTo.reserve(receipts.size());
+        for (const auto& receipt : receipts) {
+            readers.push_back(std::to_string(receipt.readerId));
+            senders.push_back(std::to_string(receipt.senderId));
+            upTo.push_back(std::to_string(receipt.upToId));
         }
 
-        pqxx::work txn(*pgConn.getConnection());
+        auto conn = pool.acquire();
+
+        pqxx::work txn(*conn);
         try {
-            txn.exec(
-                "UPDATE messages SET is_read = TRUE "
-                "WHERE receiver_id = " + txn.quote(receiverId) + " "
-                "AND sender_id = " + txn.quote(senderId) + " "
-                "AND is_read = FALSE"
-            );
+            pqxx::result res = txn.exec_prepared("mark_messages_read_upto",
+                arrayLiteral(readers, {}, false), arrayLiteral(senders, {}, false),
+                arrayLiteral(upTo, {}, false));
             txn.commit();
+            for (const auto& receipt : receipts) {
+                replicas.noteWrite({receipt.readerId, receipt.senderId});
+            }
+
+            int marked = 0;
+            for (auto row : res) {
+                marked += row[0].as<int>();
+            }
+            return marked;
         } catch (const std::exception& e) {
             try { txn.abort(); } catch (...) {}
-            std::cerr << "[PSQL.Database] markMessagesRead error: " << e.what() << std::endl;
+            std::cerr << "[PSQL.Database] markMessagesReadUpTo error: " << e.what() << std::endl;
             throw;
         }
     }
 
-    pqxx::result getInbox(int userId, int limit = 50, int offset = 0) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+    struct InboxRowView {
+        int id;
+        int senderId;
+        std::string_view body;
+    };
+
+    // The user's received messages over COPY, newest first; see
+    // streamMessagesBetween.
+    void streamInbox(int userId, int limit, int offset, const std::function<void(const InboxRowView&)>& onRow) {
+        auto conn = replicas.poolFor(userId).acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "SELECT id, sender_id, receiver_id, body, created_at "
+            pqxx::read_transaction txn(*conn);
+            auto stream = pqxx::stream_from::query(txn,
+                "SELECT id, sender_id, body "
                 "FROM messages "
-                "WHERE receiver_id = " + txn.quote(userId) + " "
+                "WHERE receiver_id = " + std::to_string(userId) + " "
+                "AND created_at >= message_retention_cutoff() "
                 "ORDER BY created_at DESC "
-                "LIMIT " + txn.quote(limit) + " OFFSET " + txn.quote(offset)
-            );
+                "LIMIT " + std::to_string(limit) + " OFFSET " + std::to_string(offset));
+            for (const auto& [id, senderId, body] : stream.iter<int, int, std::string_view>()) {
+                onRow(InboxRowView{id, senderId, body});
+            }
+            stream.complete();
             txn.commit();
-            return res;
         } catch (const std::exception& e) {
-            std::cerr << "[PSQL.Database] getInbox error: " << e.what() << std::endl;
+            std::cerr << "[PSQL.Database] streamInbox error: " << e.what() << std::endl;
             throw;
         }
     }
 
     int deleteChatMessages(int userId, int contactId) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+        auto conn = pool.acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "DELETE FROM messages "
-                "WHERE (sender_id = " + txn.quote(userId) + " AND receiver_id = " + txn.quote(contactId) + ") "
-                "   OR (sender_id = " + txn.quote(contactId) + " AND receiver_id = " + txn.quote(userId) + ") "
-                "RETURNING id"
-            );
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("delete_chat_messages", userId, contactId);
             txn.commit();
+            replicas.noteWrite({userId, contactId});
             return static_cast<int>(res.size());
         } catch (const std::exception& e) {
             std::cerr << "[PSQL.Database] deleteChatMessages error: " << e.what() << std::endl;
@@ -339,22 +1130,11 @@ public:
     }
 
     pqxx::result getChatsForUser(int userId) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+        auto conn = replicas.poolFor(userId).acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "SELECT DISTINCT u.username "
-                "FROM messages m "
-                "JOIN users u ON u.id = CASE "
-                "  WHEN m.sender_id = " + txn.quote(userId) + " THEN m.receiver_id "
-                "  ELSE m.sender_id "
-                "END "
-                "WHERE m.sender_id = " + txn.quote(userId) + " OR m.receiver_id = " + txn.quote(userId) + " "
-                "ORDER BY u.username"
-            );
+            pqxx::read_transaction txn(*conn);
+            pqxx::result res = txn.exec_prepared("get_chats_for_user", userId);
             txn.commit();
             return res;
         } catch (const std::exception& e) {
@@ -363,26 +1143,13 @@ public:
         }
     }
 
-    pqxx::result getChatsWithUnreadCounts(int userId) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+    pqxx::result getChatsWithUnreadCounts(int userId, bool byRecency = false) {
+        auto conn = replicas.poolFor(userId).acquire();
 
         try {
-            pqxx::work txn(*pgConn.getConnection());
-            pqxx::result res = txn.exec(
-                "SELECT u.username, "
-                "  COALESCE(SUM(CASE WHEN m.receiver_id = " + txn.quote(userId) + " "
-                "  AND m.is_read = FALSE THEN 1 ELSE 0 END), 0) AS unread_count "
-                "FROM messages m "
-                "JOIN users u ON u.id = CASE "
-                "  WHEN m.sender_id = " + txn.quote(userId) + " THEN m.receiver_id "
-                "  ELSE m.sender_id "
-                "END "
-                "WHERE m.sender_id = " + txn.quote(userId) + " OR m.receiver_id = " + txn.quote(userId) + " "
-                "GROUP BY u.username "
-                "ORDER BY u.username"
-            );
+            pqxx::read_transaction txn(*conn);
+            pqxx::result res = txn.exec_prepared(
+                byRecency ? "get_chats_by_recency" : "get_chats_with_unread_counts", userId);
             txn.commit();
             return res;
         } catch (const std::exception& e) {
@@ -391,82 +1158,46 @@ public:
         }
     }
 
-    std::vector<int> getChatPartnerIds(int userId) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+    struct PartitionMaintenance {
+        int created;
+        int dropped;
+    };
+
+    // Creates monthly partitions through monthsAhead from now and drops the
+    // ones entirely past the retention period. Cheap enough to run hourly.
+    PartitionMaintenance maintainMessagePartitions(int monthsAhead) {
+        auto conn = pool.acquire();
 
-        pqxx::work txn(*pgConn.getConnection());
         try {
-            pqxx::result res = txn.exec(
-                "SELECT DISTINCT CASE "
-                "  WHEN sender_id = " + txn.quote(userId) + " THEN receiver_id "
-                "  ELSE sender_id "
-                "END AS partner_id "
-                "FROM messages "
-                "WHERE sender_id = " + txn.quote(userId) + " OR receiver_id = " + txn.quote(userId)
-            );
+            pqxx::work txn(*conn);
+            pqxx::result res = txn.exec_prepared("maintain_message_partitions", monthsAhead);
             txn.commit();
-
-            std::vector<int> partners;
-            partners.reserve(res.size());
-            for (auto row : res) {
-                partners.push_back(row["partner_id"].as<int>());
-            }
-            return partners;
+            return PartitionMaintenance{res[0]["created"].as<int>(), res[0]["dropped"].as<int>()};
         } catch (const std::exception& e) {
-            try { txn.abort(); } catch (...) {}
-            std::cerr << "[PSQL.Database] getChatPartnerIds error: " << e.what() << std::endl;
+            std::cerr << "[PSQL.Database] maintainMessagePartitions error: " << e.what() << std::endl;
             throw;
         }
     }
 
-    // Combined operation to get messages and mark as read in single transaction
-    pqxx::result getMessagesAndMarkRead(int userId, int contactId, int limit = 50, int offset = 0) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
-        }
+    // Messages older than days are hidden from reads at once and their
+    // partitions dropped by the next maintenance run; 0 keeps everything.
+    void setMessageRetention(int days) {
+        auto conn = pool.acquire();
 
-        pqxx::work txn(*pgConn.getConnection());
         try {
-            pqxx::result res = txn.exec(
-                "SELECT id, sender_id, receiver_id, body, e2e_payload, e2e_pub, created_at, is_read "
-                "FROM ("
-                "  SELECT id, sender_id, receiver_id, body, e2e_payload, e2e_pub, created_at, is_read "
-                "  FROM messages "
-                "  WHERE (sender_id = " + txn.quote(userId) + " AND receiver_id = " + txn.quote(contactId) + ") "
-                "     OR (sender_id = " + txn.quote(contactId) + " AND receiver_id = " + txn.quote(userId) + ") "
-                "  ORDER BY created_at DESC "
-                "  LIMIT " + txn.quote(limit) + " OFFSET " + txn.quote(offset) +
-                ") sub "
-                "ORDER BY created_at ASC"
-            );
-            
-            // Mark as read in same transaction
-            txn.exec(
-                "UPDATE messages SET is_read = TRUE "
-                "WHERE receiver_id = " + txn.quote(userId) + " "
-                "AND sender_id = " + txn.quote(contactId) + " "
-                "AND is_read = FALSE"
-            );
-            
+            pqxx::work txn(*conn);
+            txn.exec_prepared("set_message_retention", days);
             txn.commit();
-            return res;
         } catch (const std::exception& e) {
-            try { txn.abort(); } catch (...) {}
-            std::cerr << "[PSQL.Database] getMessagesAndMarkRead error: " << e.what() << std::endl;
+            std::cerr << "[PSQL.Database] setMessageRetention error: " << e.what() << std::endl;
             throw;
         }
     }
 
     bool testConnection() {
-        if (!pgConn.isConnected()) {
-            std::cerr << "[PSQL.Database] Database not connected" << std::endl;
-            return false;
-        }
-
         try {
-            pqxx::work txn(*pgConn.getConnection());
+            auto conn = pool.acquire();
+            pqxx::work txn(*conn);
 
             pqxx::result insertRes = txn.exec(
                 "INSERT INTO mes_db (name) VALUES ('test_row') RETURNING id, name, created_at"
@@ -480,8 +1211,8 @@ public:
 
             int insertedId = insertRes[0]["id"].as<int>();
 
-            pqxx::result selectRes = txn.exec(
-                "SELECT id, name, created_at FROM mes_db WHERE id = " + txn.quote(insertedId)
+            pqxx::result selectRes = txn.exec_params(
+                "SELECT id, name, created_at FROM mes_db WHERE id = $1", insertedId
             );
 
             txn.commit();
@@ -505,16 +1236,138 @@ public:
 
     
 private:
-    PostgresConnection pgConn;
+    // Stores the avatar in $2 (bytea, mime $3) for user $1 and points the
+    // user at it; identical images share one avatars row. The caller's
+    // query reads the new hash from "updated".
+    static std::string withAvatarStored(const std::string& query) {
+        return "WITH blob AS ("
+               "  SELECT encode(sha256(data), 'hex') AS hash, data "
+               "  FROM (SELECT $2::bytea AS data) d"
+               "), stored AS ("
+               "  INSERT INTO avatars (hash, mime, data) "
+               "  SELECT hash, $3, data FROM blob "
+               "  ON CONFLICT (hash) DO NOTHING"
+               "), updated AS ("
+               "  UPDATE users SET avatar_hash = blob.hash "
+               "  FROM blob "
+               "  WHERE users.id = $1 "
+               "  RETURNING users.avatar_hash"
+               ") " + query;
+    }
 
-    pqxx::result* executeQuery(const std::string& query) {
-        if (!pgConn.isConnected()) {
-            throw std::runtime_error("[PSQL.Database] Database not connected");
+    // Wraps a messages INSERT so the same statement folds the new rows into
+    // chat_summaries: the sender's row for the pair is touched, the
+    // receiver's also gains one unread. Returns the new ids.
+    static std::string withChatSummary(const std::string& insert) {
+        return "WITH inserted AS (" + insert + " RETURNING id, sender_id, receiver_id, created_at), "
+               "summary AS ("
+               "  INSERT INTO chat_summaries (user_id, partner_id, unread_count, last_message_id, last_activity) "
+               "  SELECT s.user_id, s.partner_id, SUM(s.unread), MAX(s.id), MAX(s.created_at) "
+               "  FROM inserted m "
+               "  CROSS JOIN LATERAL (VALUES "
+               "    (m.sender_id, m.receiver_id, 0, m.id, m.created_at), "
+               "    (m.receiver_id, m.sender_id, 1, m.id, m.created_at)"
+               "  ) AS s(user_id, partner_id, unread, id, created_at) "
+               "  GROUP BY s.user_id, s.partner_id "
+               "  ON CONFLICT (user_id, partner_id) DO UPDATE SET "
+               "    unread_count = chat_summaries.unread_count + EXCLUDED.unread_count, "
+               "    last_message_id = GREATEST(chat_summaries.last_message_id, EXCLUDED.last_message_id), "
+               "    last_activity = GREATEST(chat_summaries.last_activity, EXCLUDED.last_activity)"
+               ") "
+               "SELECT id FROM inserted";
+    }
+
+    // COPY takes no parameters, so the streamed page is plain SQL text; every
+    // value in it is an integer. Keyset pages seek to the cursor inside each
+    // partition's idx_messages_conversation_key, so a page costs the same
+    // however deep it is.
+    static std::string conversationStreamQuery(int userA, int userB, int limit, int offset,
+                                               const MessageCursor& cursor) {
+        const std::string columns = "id, sender_id, is_read, body, e2e_payload, e2e_pub";
+        const std::string conversation =
+            "conversation_key = conversation_key_of(" + std::to_string(userA) + ", " + std::to_string(userB) + ") "
+            "AND created_at >= message_retention_cutoff() ";
+        if (cursor.afterId > 0) {
+            return "SELECT " + columns + " FROM messages "
+                   "WHERE " + conversation + "AND id > " + std::to_string(cursor.afterId) + " "
+                   "ORDER BY id ASC LIMIT " + std::to_string(limit);
+        }
+        std::string newest = "SELECT " + columns + " FROM messages WHERE " + conversation;
+        if (cursor.beforeId > 0) {
+            newest += "AND id < " + std::to_string(cursor.beforeId) + " ";
+        }
+        newest += "ORDER BY id DESC LIMIT " + std::to_string(limit);
+        if (offset > 0) {
+            newest += " OFFSET " + std::to_string(offset);
+        }
+        return "SELECT " + columns + " FROM (" + newest + ") sub ORDER BY id ASC";
+    }
+
+    void streamMessages(int userA, const std::string& query, const char* what, const MessageRowFn& onRow) {
+        auto conn = replicas.poolFor(userA).acquire();
+
+        try {
+            pqxx::read_transaction txn(*conn);
+            auto stream = pqxx::stream_from::query(txn, query);
+            // bytea comes out of COPY hex-escaped; pqxx unescapes it into
+            // the raw ciphertext.
+            for (const auto& [id, senderId, isRead, body, e2ePayload, e2ePub] :
+                 stream.iter<int, int, bool, std::string_view,
+                             std::optional<std::basic_string<std::byte>>, std::optional<std::string_view>>()) {
+                std::optional<std::string_view> payload;
+                if (e2ePayload) {
+                    payload.emplace(reinterpret_cast<const char*>(e2ePayload->data()), e2ePayload->size());
+                }
+                onRow(MessageRowView{id, senderId, isRead, body, payload, e2ePub});
+            }
+            stream.complete();
+            txn.commit();
+        } catch (const std::exception& e) {
+            std::cerr << "[PSQL.Database] " << what << " error: " << e.what() << std::endl;
+            throw;
+        }
+    }
+
+    // Postgres array literal for binding a whole column as one parameter.
+    // Quoted elements escape backslashes and double quotes; nulls[i] (when
+    // given) writes an unquoted NULL instead.
+    static std::string arrayLiteral(const std::vector<std::string>& values,
+                                    const std::vector<bool>& nulls, bool quote) {
+        std::string out = "{";
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (i > 0) {
+                out += ',';
+            }
+            if (!nulls.empty() && nulls[i]) {
+                out += "NULL";
+                continue;
+            }
+            if (!quote) {
+                out += values[i];
+                continue;
+            }
+            out += '"';
+            for (char c : values[i]) {
+                if (c == '"' || c == '\\') {
+                    out += '\\';
+                }
+                out += c;
+            }
+            out += '"';
         }
+        out += '}';
+        return out;
+    }
+
+    PostgresConnectionPool pool;
+    ReplicaRouter replicas;
+
+    pqxx::result* executeQuery(const std::string& query) {
+        auto conn = pool.acquire();
 
         try 
         {
-            pqxx::work txn(*pgConn.getConnection());
+            pqxx::work txn(*conn);
             pqxx::result res = txn.exec(query);
             txn.commit();
             return new pqxx::result(res);
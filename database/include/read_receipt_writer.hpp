@@ -0,0 +1,140 @@
+#pragma once
+
+#include "postgresql.hpp"
+#include <map>
+#include <thread>
+#include <utility>
+
+// Takes read-marking off the GET_MESSAGES path. markRead() only records the
+// highest message id a reader has seen from a sender; one writer thread
+// applies everything recorded since its last pass with a single
+// markMessagesReadUpTo call.
+//
+// A pass runs maxDelay after the first receipt of a batch arrives, so a
+// reader scrolling through a chat costs one UPDATE per pass rather than one
+// per page. Receipts are lost only if the process dies before a pass; the
+// messages then simply stay unread.
+class ReadReceiptWriter {
+public:
+    struct Stats {
+        uint64_t recorded;      // markRead calls
+        uint64_t flushes;
+        uint64_t receipts;      // (reader, sender) pairs written
+        uint64_t marked;        // messages that changed to read
+        uint64_t failedFlushes;
+    };
+
+    ReadReceiptWriter(PostgresDatabase& db, std::chrono::milliseconds maxDelay)
+        : db(db), maxDelay(maxDelay), running(true),
+          recorded(0), flushes(0), receipts(0), marked(0), failedFlushes(0) {
+        writer = std::thread(&ReadReceiptWriter::run, this);
+    }
+
+    ~ReadReceiptWriter() {
+        stop();
+    }
+
+    ReadReceiptWriter(const ReadReceiptWriter&) = delete;
+    ReadReceiptWriter& operator=(const ReadReceiptWriter&) = delete;
+
+    void markRead(int readerId, int senderId, int upToId) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) {
+                return;
+            }
+            if (pending.empty()) {
+                firstPendingAt = std::chrono::steady_clock::now();
+            }
+            int& highest = pending[std::make_pair(readerId, senderId)];
+            highest = std::max(highest, upToId);
+        }
+        recorded++;
+        cv.notify_one();
+    }
+
+    // Writes whatever is pending, then joins the writer.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) {
+                return;
+            }
+            running = false;
+        }
+        cv.notify_one();
+        if (writer.joinable()) {
+            writer.join();
+        }
+    }
+
+    Stats stats() const {
+        return Stats{recorded.load(), flushes.load(), receipts.load(), marked.load(), failedFlushes.load()};
+    }
+
+private:
+    using Key = std::pair<int, int>;   // (reader, sender)
+
+    PostgresDatabase& db;
+    const std::chrono::milliseconds maxDelay;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<Key, int> pending;
+    std::chrono::steady_clock::time_point firstPendingAt;
+    bool running;
+    std::thread writer;
+
+    std::atomic<uint64_t> recorded;
+    std::atomic<uint64_t> flushes;
+    std::atomic<uint64_t> receipts;
+    std::atomic<uint64_t> marked;
+    std::atomic<uint64_t> failedFlushes;
+
+    void run() {
+        std::map<Key, int> batch;
+        std::vector<PostgresDatabase::ReadReceipt> rows;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return !pending.empty() || !running; });
+                if (pending.empty()) {
+                    return;
+                }
+
+                cv.wait_until(lock, firstPendingAt + maxDelay, [this] { return !running; });
+                batch.swap(pending);
+            }
+
+            rows.clear();
+            for (const auto& entry : batch) {
+                rows.push_back(PostgresDatabase::ReadReceipt{entry.first.first, entry.first.second, entry.second});
+            }
+
+            try {
+                marked += static_cast<uint64_t>(db.markMessagesReadUpTo(rows));
+                receipts += rows.size();
+                batch.clear();
+            } catch (const std::exception& e) {
+                failedFlushes++;
+                std::cerr << "[PSQL.ReadReceipts] flush of " << rows.size()
+                          << " receipts failed: " << e.what() << std::endl;
+                // Fold the batch back in so the next pass retries it; a
+                // stopping writer gives up instead of spinning.
+                std::lock_guard<std::mutex> lock(mutex);
+                if (running) {
+                    if (pending.empty()) {
+                        firstPendingAt = std::chrono::steady_clock::now();
+                    }
+                    for (const auto& entry : batch) {
+                        int& highest = pending[entry.first];
+                        highest = std::max(highest, entry.second);
+                    }
+                }
+                batch.clear();
+            }
+            flushes++;
+        }
+    }
+};
@@ -7,27 +7,247 @@ CREATE TABLE IF NOT EXISTS users (
     id SERIAL PRIMARY KEY,
     username TEXT NOT NULL UNIQUE,
     password_hash TEXT NOT NULL,
-    avatar_b64 TEXT,
+    avatar_b64 TEXT,        -- legacy inline avatar, moved to avatars below
     avatar_mime TEXT,
+    avatar_hash TEXT,
     e2e_pub TEXT,
     created_at TIMESTAMPTZ NOT NULL DEFAULT NOW()
 );
 
+-- Avatars are stored once per distinct image, keyed by the hex SHA-256 of
+-- their bytes. Rows are immutable, so a client holding a hash never needs
+-- to fetch it again.
+CREATE TABLE IF NOT EXISTS avatars (
+    hash TEXT PRIMARY KEY,
+    mime TEXT NOT NULL,
+    data BYTEA NOT NULL,
+    created_at TIMESTAMPTZ NOT NULL DEFAULT NOW()
+);
+
+ALTER TABLE users ADD COLUMN IF NOT EXISTS avatar_hash TEXT;
+
+-- Databases that still hold base64 avatars inline in users.
+INSERT INTO avatars (hash, mime, data)
+SELECT encode(sha256(decode(avatar_b64, 'base64')), 'hex'),
+       COALESCE(avatar_mime, 'application/octet-stream'),
+       decode(avatar_b64, 'base64')
+FROM users
+WHERE avatar_b64 IS NOT NULL
+ON CONFLICT (hash) DO NOTHING;
+
+UPDATE users
+SET avatar_hash = encode(sha256(decode(avatar_b64, 'base64')), 'hex'),
+    avatar_b64 = NULL,
+    avatar_mime = NULL
+WHERE avatar_b64 IS NOT NULL;
+
+-- Order-independent id for the conversation between two users: the smaller
+-- id in the high 32 bits, the larger in the low 32.
+CREATE OR REPLACE FUNCTION conversation_key_of(a INTEGER, b INTEGER) RETURNS BIGINT
+    LANGUAGE SQL IMMUTABLE PARALLEL SAFE
+    AS $$ SELECT (LEAST(a, b)::BIGINT << 32) | GREATEST(a, b)::BIGINT $$;
+
+CREATE SEQUENCE IF NOT EXISTS messages_id_seq;
+
+-- messages used to be a single heap. Move an unpartitioned table aside so
+-- the partitioned one can take its name; its rows are copied further down.
+-- Its indexes and primary key are dropped first because their names would
+-- collide with the new table's.
+DO $$
+BEGIN
+    IF EXISTS (SELECT 1 FROM pg_class c
+               JOIN pg_namespace n ON n.oid = c.relnamespace
+               WHERE n.nspname = current_schema() AND c.relname = 'messages' AND c.relkind = 'r') THEN
+        ALTER SEQUENCE messages_id_seq OWNED BY NONE;
+        ALTER TABLE messages ALTER COLUMN id DROP DEFAULT;
+        ALTER TABLE messages DROP CONSTRAINT messages_pkey;
+        DROP INDEX IF EXISTS idx_messages_sender, idx_messages_receiver, idx_messages_receiver_unread,
+                              idx_messages_created_at, idx_messages_conversation,
+                              idx_messages_conversation_key;
+        ALTER TABLE messages RENAME TO messages_unpartitioned;
+    END IF;
+END $$;
+
+-- Range-partitioned by month on created_at, so old months can be dropped
+-- whole and every index stays the size of one month. The partition key has
+-- to be part of the primary key; ids still come from one sequence.
 CREATE TABLE IF NOT EXISTS messages (
-    id SERIAL PRIMARY KEY,
+    id INTEGER NOT NULL DEFAULT nextval('messages_id_seq'),
     sender_id INTEGER NOT NULL REFERENCES users(id) ON DELETE CASCADE,
     receiver_id INTEGER NOT NULL REFERENCES users(id) ON DELETE CASCADE,
     body TEXT NOT NULL,
-    e2e_payload TEXT,
+    e2e_payload BYTEA,
     e2e_pub TEXT,
     created_at TIMESTAMPTZ NOT NULL DEFAULT NOW(),
-    is_read BOOLEAN NOT NULL DEFAULT FALSE
-);
+    is_read BOOLEAN NOT NULL DEFAULT FALSE,
+    conversation_key BIGINT GENERATED ALWAYS AS (conversation_key_of(sender_id, receiver_id)) STORED,
+    PRIMARY KEY (id, created_at)
+) PARTITION BY RANGE (created_at);
+
+ALTER SEQUENCE messages_id_seq OWNED BY messages.id;
+
+-- E2E ciphertext used to be kept as base64 text; it is raw bytes now.
+DO $$
+BEGIN
+    IF EXISTS (SELECT 1 FROM information_schema.columns
+               WHERE table_schema = current_schema() AND table_name = 'messages'
+                 AND column_name = 'e2e_payload' AND data_type = 'text') THEN
+        ALTER TABLE messages ALTER COLUMN e2e_payload TYPE BYTEA USING decode(e2e_payload, 'base64');
+    END IF;
+END $$;
+
+-- Catches rows no monthly partition covers. It should stay empty: a month
+-- cannot be attached while the default holds rows for it.
+CREATE TABLE IF NOT EXISTS messages_default PARTITION OF messages DEFAULT;
 
 CREATE INDEX IF NOT EXISTS idx_messages_sender ON messages(sender_id);
 CREATE INDEX IF NOT EXISTS idx_messages_receiver ON messages(receiver_id);
 CREATE INDEX IF NOT EXISTS idx_messages_receiver_unread ON messages(receiver_id, is_read);
-CREATE INDEX IF NOT EXISTS idx_messages_created_at ON messages(created_at);
+-- Every two-party read and delete is one range scan of this index per
+-- partition; keyset pages seek to their cursor id within it.
+CREATE INDEX IF NOT EXISTS idx_messages_conversation_key ON messages(conversation_key, id);
+
+-- Creates the missing monthly partitions messages_pYYYYMM from the month of
+-- from_ts through the month of to_ts. Months are UTC so the bounds do not
+-- depend on the session time zone. Returns how many were created.
+CREATE OR REPLACE FUNCTION create_message_partitions(from_ts TIMESTAMPTZ, to_ts TIMESTAMPTZ)
+    RETURNS INTEGER LANGUAGE plpgsql AS $$
+DECLARE
+    month_start TIMESTAMPTZ := date_trunc('month', from_ts AT TIME ZONE 'UTC') AT TIME ZONE 'UTC';
+    partition_name TEXT;
+    created INTEGER := 0;
+BEGIN
+    WHILE month_start <= to_ts LOOP
+        partition_name := 'messages_p' || to_char(month_start AT TIME ZONE 'UTC', 'YYYYMM');
+        IF to_regclass(partition_name) IS NULL THEN
+            EXECUTE format('CREATE TABLE %I PARTITION OF messages FOR VALUES FROM (%L) TO (%L)',
+                           partition_name, month_start, month_start + INTERVAL '1 month');
+            created := created + 1;
+        END IF;
+        month_start := month_start + INTERVAL '1 month';
+    END LOOP;
+    RETURN created;
+END $$;
+
+-- Moves rows that landed in messages_default (e.g. from a bulk import of
+-- old history) into monthly partitions created for them. Returns how many
+-- rows were moved.
+CREATE OR REPLACE FUNCTION rehome_default_messages()
+    RETURNS BIGINT LANGUAGE plpgsql AS $$
+DECLARE
+    lo TIMESTAMPTZ;
+    hi TIMESTAMPTZ;
+    moved BIGINT;
+BEGIN
+    SELECT MIN(created_at), MAX(created_at) INTO lo, hi FROM messages_default;
+    IF lo IS NULL THEN
+        RETURN 0;
+    END IF;
+
+    CREATE TEMP TABLE rehomed_messages (LIKE messages_default) ON COMMIT DROP;
+    WITH taken AS (
+        DELETE FROM messages_default
+        RETURNING id, sender_id, receiver_id, body, e2e_payload, e2e_pub, created_at, is_read
+    )
+    INSERT INTO rehomed_messages (id, sender_id, receiver_id, body, e2e_payload, e2e_pub, created_at, is_read)
+    SELECT * FROM taken;
+
+    PERFORM create_message_partitions(lo, hi);
+    INSERT INTO messages (id, sender_id, receiver_id, body, e2e_payload, e2e_pub, created_at, is_read)
+    SELECT id, sender_id, receiver_id, body, e2e_payload, e2e_pub, created_at, is_read
+    FROM rehomed_messages;
+    GET DIAGNOSTICS moved = ROW_COUNT;
+    DROP TABLE rehomed_messages;
+    RETURN moved;
+END $$;
+
+-- How long messages are kept; NULL keeps them forever.
+CREATE TABLE IF NOT EXISTS message_retention (
+    singleton BOOLEAN PRIMARY KEY DEFAULT TRUE CHECK (singleton),
+    keep INTERVAL
+);
+INSERT INTO message_retention (keep) VALUES (NULL) ON CONFLICT DO NOTHING;
+
+-- Reads filter on created_at >= this, which hides expired rows before their
+-- partition is dropped and lets the planner skip those partitions.
+CREATE OR REPLACE FUNCTION message_retention_cutoff() RETURNS TIMESTAMPTZ
+    LANGUAGE SQL STABLE
+    AS $$ SELECT COALESCE(NOW() - (SELECT keep FROM message_retention), '-infinity'::TIMESTAMPTZ) $$;
+
+-- Detaches and drops every monthly partition that ends before the retention
+-- cutoff, in place of a DELETE over the expired rows. Unread messages in a
+-- dropped month stop counting in chat_summaries. Returns how many were
+-- dropped.
+CREATE OR REPLACE FUNCTION drop_expired_message_partitions()
+    RETURNS INTEGER LANGUAGE plpgsql AS $$
+DECLARE
+    cutoff TIMESTAMPTZ := message_retention_cutoff();
+    part RECORD;
+    dropped INTEGER := 0;
+BEGIN
+    FOR part IN
+        SELECT c.relname,
+               (to_date(substr(c.relname, 11), 'YYYYMM')::TIMESTAMP AT TIME ZONE 'UTC') + INTERVAL '1 month' AS ends_at
+        FROM pg_inherits i
+        JOIN pg_class c ON c.oid = i.inhrelid
+        WHERE i.inhparent = 'messages'::regclass
+          AND c.relname ~ '^messages_p[0-9]{6}$'
+        ORDER BY c.relname
+    LOOP
+        EXIT WHEN part.ends_at > cutoff;
+        EXECUTE format(
+            'UPDATE chat_summaries s SET unread_count = GREATEST(s.unread_count - d.n, 0) '
+            'FROM (SELECT receiver_id, sender_id, COUNT(*) AS n FROM %I WHERE NOT is_read '
+            '      GROUP BY receiver_id, sender_id) d '
+            'WHERE s.user_id = d.receiver_id AND s.partner_id = d.sender_id', part.relname);
+        EXECUTE format('ALTER TABLE messages DETACH PARTITION %I', part.relname);
+        EXECUTE format('DROP TABLE %I', part.relname);
+        dropped := dropped + 1;
+    END LOOP;
+    RETURN dropped;
+END $$;
+
+SELECT create_message_partitions(NOW(), NOW() + INTERVAL '3 months');
+
+-- Copy rows out of a pre-partitioning table, creating the months they need.
+DO $$
+BEGIN
+    IF to_regclass('messages_unpartitioned') IS NOT NULL THEN
+        PERFORM create_message_partitions(
+            (SELECT COALESCE(MIN(created_at), NOW()) FROM messages_unpartitioned), NOW());
+        INSERT INTO messages (id, sender_id, receiver_id, body, e2e_payload, e2e_pub, created_at, is_read)
+        SELECT id, sender_id, receiver_id, body, decode(e2e_payload, 'base64'), e2e_pub, created_at, is_read
+        FROM messages_unpartitioned;
+        DROP TABLE messages_unpartitioned;
+    END IF;
+END $$;
+
+-- One row per (user, partner) pair, maintained by the same statements that
+-- insert, mark read, and delete messages, so GET_CHATS never aggregates
+-- message history.
+CREATE TABLE IF NOT EXISTS chat_summaries (
+    user_id INTEGER NOT NULL REFERENCES users(id) ON DELETE CASCADE,
+    partner_id INTEGER NOT NULL REFERENCES users(id) ON DELETE CASCADE,
+    unread_count INTEGER NOT NULL DEFAULT 0,
+    last_message_id INTEGER NOT NULL,
+    last_activity TIMESTAMPTZ NOT NULL,
+    PRIMARY KEY (user_id, partner_id)
+);
+
+CREATE INDEX IF NOT EXISTS idx_chat_summaries_recent
+    ON chat_summaries(user_id, last_activity DESC);
+
+-- Backfill for databases that already hold messages; rows that exist are
+-- already being maintained and are left alone.
+INSERT INTO chat_summaries (user_id, partner_id, unread_count, last_message_id, last_activity)
+SELECT s.user_id, s.partner_id, SUM(s.unread), MAX(s.id), MAX(s.created_at)
+FROM messages m
+CROSS JOIN LATERAL (VALUES
+    (m.sender_id, m.receiver_id, 0, m.id, m.created_at),
+    (m.receiver_id, m.sender_id, CASE WHEN m.is_read THEN 0 ELSE 1 END, m.id, m.created_at)
+) AS s(user_id, partner_id, unread, id, created_at)
+GROUP BY s.user_id, s.partner_id
+ON CONFLICT (user_id, partner_id) DO NOTHING;
 
 -- Used by PostgresDatabase::testConnection()
 CREATE TABLE IF NOT EXISTS mes_db (
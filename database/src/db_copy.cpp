@@ -0,0 +1,246 @@
+// Bulk export/import of users, avatars and messages over COPY.
+//
+//   db_copy export <table> [file]    COPY (SELECT ...) TO STDOUT into file or stdout
+//   db_copy import <table> [file]    COPY ... FROM STDIN out of file or stdin
+//
+// Rows travel as COPY text lines, one at a time, so memory stays flat
+// however large the table is. The connection string comes from --db=,
+// PGCONN, or PGHOST/PGPORT/PGDATABASE/PGUSER[/PGPASSWORD].
+#include <pqxx/pqxx>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct TableSpec {
+    const char* name;
+    const char* columns;   // generated columns are left out; Postgres recomputes them
+    const char* orderBy;
+};
+
+const TableSpec kTables[] = {
+    {"users", "id, username, password_hash, avatar_hash, e2e_pub, created_at", "id"},
+    {"avatars", "hash, mime, data, created_at", "hash"},
+    {"messages", "id, sender_id, receiver_id, body, e2e_payload, e2e_pub, created_at, is_read", "id"},
+};
+
+constexpr uint64_t kProgressEvery = 100000;
+
+const TableSpec* findTable(const std::string& name) {
+    for (const auto& table : kTables) {
+        if (name == table.name) {
+            return &table;
+        }
+    }
+    return nullptr;
+}
+
+std::string connStrFromEnv() {
+    const char* pgconn = std::getenv("PGCONN");
+    if (pgconn && *pgconn) {
+        return std::string(pgconn);
+    }
+
+    const char* host = std::getenv("PGHOST");
+    const char* port = std::getenv("PGPORT");
+    const char* dbname = std::getenv("PGDATABASE");
+    const char* user = std::getenv("PGUSER");
+    const char* password = std::getenv("PGPASSWORD");
+
+    if (!host || !dbname || !user) {
+        return {};
+    }
+
+    std::string conn = "host=" + std::string(host);
+    if (port && *port) conn += " port=" + std::string(port);
+    conn += " dbname=" + std::string(dbname);
+    conn += " user=" + std::string(user);
+    if (password && *password) conn += " password=" + std::string(password);
+    return conn;
+}
+
+class Progress {
+public:
+    explicit Progress(const std::string& label)
+        : label(label), rows(0), start(std::chrono::steady_clock::now()) {}
+
+    void add() {
+        if (++rows % kProgressEvery == 0) {
+            report("");
+        }
+    }
+
+    void finish() {
+        report(" done");
+    }
+
+    uint64_t count() const { return rows; }
+
+private:
+    std::string label;
+    uint64_t rows;
+    std::chrono::steady_clock::time_point start;
+
+    void report(const char* suffix) const {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const double rate = seconds > 0 ? static_cast<double>(rows) / seconds : 0.0;
+        std::fprintf(stderr, "[COPY] %s: %llu rows in %.1fs, %.0f rows/s%s\n", label.c_str(),
+                     static_cast<unsigned long long>(rows), seconds, rate, suffix);
+    }
+};
+
+uint64_t exportTable(pqxx::connection& conn, const TableSpec& table, std::FILE* out) {
+    pqxx::read_transaction txn(conn);
+    auto stream = pqxx::stream_from::query(
+        txn, std::string("SELECT ") + table.columns + " FROM " + table.name + " ORDER BY " + table.orderBy);
+
+    Progress progress(std::string("export ") + table.name);
+    while (true) {
+        auto line = stream.get_raw_line();
+        if (!line.first) {
+            break;
+        }
+        std::fwrite(line.first.get(), 1, line.second, out);
+        std::fputc('\n', out);
+        progress.add();
+    }
+    stream.complete();
+    txn.commit();
+    if (std::fflush(out) != 0) {
+        throw std::runtime_error("write failed: " + std::string(std::strerror(errno)));
+    }
+    progress.finish();
+    return progress.count();
+}
+
+// Imported rows keep their ids, so the id sequences are moved past them.
+// Message rows outside the existing monthly partitions land in the default
+// partition and are moved into new months; chat_summaries is rebuilt from
+// the messages now present.
+void finishImport(pqxx::work& txn, const TableSpec& table) {
+    const std::string name = table.name;
+    if (name == "users") {
+        txn.exec("SELECT setval(pg_get_serial_sequence('users', 'id'), GREATEST((SELECT MAX(id) FROM users), 1))");
+    } else if (name == "messages") {
+        txn.exec("SELECT setval('messages_id_seq', GREATEST((SELECT MAX(id) FROM messages), 1))");
+        pqxx::result moved = txn.exec("SELECT rehome_default_messages()");
+        std::fprintf(stderr, "[COPY] moved %s rows out of messages_default\n", moved[0][0].c_str());
+        txn.exec(
+            "INSERT INTO chat_summaries (user_id, partner_id, unread_count, last_message_id, last_activity) "
+            "SELECT s.user_id, s.partner_id, SUM(s.unread), MAX(s.id), MAX(s.created_at) "
+            "FROM messages m "
+            "CROSS JOIN LATERAL (VALUES "
+            "  (m.sender_id, m.receiver_id, 0, m.id, m.created_at), "
+            "  (m.receiver_id, m.sender_id, CASE WHEN m.is_read THEN 0 ELSE 1 END, m.id, m.created_at)"
+            ") AS s(user_id, partner_id, unread, id, created_at) "
+            "GROUP BY s.user_id, s.partner_id "
+            "ON CONFLICT (user_id, partner_id) DO UPDATE SET "
+            "  unread_count = EXCLUDED.unread_count, "
+            "  last_message_id = EXCLUDED.last_message_id, "
+            "  last_activity = EXCLUDED.last_activity");
+    }
+}
+
+uint64_t importTable(pqxx::connection& conn, const TableSpec& table, std::FILE* in) {
+    pqxx::work txn(conn);
+    auto stream = pqxx::stream_to::raw_table(txn, table.name, table.columns);
+
+    Progress progress(std::string("import ") + table.name);
+    std::string line;
+    char buffer[64 * 1024];
+    while (std::fgets(buffer, sizeof(buffer), in)) {
+        line += buffer;
+        if (line.empty() || line.back() != '\n') {
+            continue;   // row longer than the buffer; keep reading
+        }
+        line.pop_back();
+        stream.write_raw_line(line);
+        line.clear();
+        progress.add();
+    }
+    if (std::ferror(in)) {
+        throw std::runtime_error("read failed: " + std::string(std::strerror(errno)));
+    }
+    if (!line.empty()) {
+        stream.write_raw_line(line);
+        progress.add();
+    }
+    stream.complete();
+
+    finishImport(txn, table);
+    txn.commit();
+    progress.finish();
+    return progress.count();
+}
+
+void usage() {
+    std::cerr << "usage: db_copy export|import users|avatars|messages [file] [--db=connstr]\n"
+              << "       file defaults to stdout for export and stdin for import" << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string connstr;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--db=", 0) == 0) {
+            connstr = arg.substr(5);
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (connstr.empty()) {
+        connstr = connStrFromEnv();
+    }
+
+    if (args.size() < 2 || args.size() > 3 || (args[0] != "export" && args[0] != "import")) {
+        usage();
+        return 2;
+    }
+    const TableSpec* table = findTable(args[1]);
+    if (!table) {
+        std::cerr << "[COPY] Unknown table: " << args[1] << std::endl;
+        usage();
+        return 2;
+    }
+    if (connstr.empty()) {
+        std::cerr << "[COPY] No connection string; use --db= or PGCONN" << std::endl;
+        return 2;
+    }
+
+    const bool exporting = args[0] == "export";
+    const std::string path = args.size() == 3 ? args[2] : "-";
+    std::FILE* file = path == "-" ? (exporting ? stdout : stdin)
+                                  : std::fopen(path.c_str(), exporting ? "wb" : "rb");
+    if (!file) {
+        std::cerr << "[COPY] Cannot open " << path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    int status = 0;
+    try {
+        pqxx::connection conn(connstr);
+        if (exporting) {
+            exportTable(conn, *table, file);
+        } else {
+            importTable(conn, *table, file);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[COPY] " << args[0] << " " << table->name << " failed: " << e.what() << std::endl;
+        status = 1;
+    }
+
+    if (file != stdout && file != stdin) {
+        std::fclose(file);
+    }
+    return status;
+}
@@ -1,7 +1,13 @@
 #include <iostream>
+#include <algorithm>
 #include <cstdlib>
 #include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
 #include "postgresql.hpp"
+#include "message_batcher.hpp"
+#include "read_receipt_writer.hpp"
 
 static std::string buildConnStrFromEnv() {
     const char* pgconn = std::getenv("PGCONN");
@@ -36,6 +42,21 @@ static bool ensure(bool condition, const std::string& message) {
     return true;
 }
 
+// Ids of one streamed conversation page, oldest first.
+static std::vector<int> pageIds(PostgresDatabase& db, int userA, int userB, int limit,
+                                const PostgresDatabase::MessageCursor& cursor) {
+    std::vector<int> ids;
+    db.streamMessagesBetween(userA, userB, limit, cursor,
+                             [&ids](const PostgresDatabase::MessageRowView& row) { ids.push_back(row.id); });
+    return ids;
+}
+
+static size_t inboxSize(PostgresDatabase& db, int userId) {
+    size_t rows = 0;
+    db.streamInbox(userId, 50, 0, [&rows](const PostgresDatabase::InboxRowView&) { ++rows; });
+    return rows;
+}
+
 int main(int argc, char** argv) {
     std::string connstr;
     if (argc > 1) {
@@ -67,11 +88,158 @@ int main(int argc, char** argv) {
         int msgId = db.insertMessage(userAId, userBId, "hello from tests");
         allOk &= ensure(msgId > 0, "insertMessage(userA->userB)");
 
-        pqxx::result convo = db.getMessagesBetween(userAId, userBId, 50, 0);
-        allOk &= ensure(!convo.empty(), "getMessagesBetween(userA,userB)");
+        allOk &= ensure(!pageIds(db, userAId, userBId, 50, PostgresDatabase::MessageCursor()).empty(),
+                        "streamMessagesBetween(userA,userB)");
+        allOk &= ensure(inboxSize(db, userBId) > 0, "streamInbox(userB)");
+
+        std::atomic<int> concurrentHits(0);
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 8; ++i) {
+            readers.emplace_back([&db, &concurrentHits] {
+                if (!db.getUserByUsername("test_user_a").empty()) {
+                    ++concurrentHits;
+                }
+            });
+        }
+        for (auto& t : readers) {
+            t.join();
+        }
+        allOk &= ensure(concurrentHits == 8, "concurrent getUserByUsername over the pool");
+
+        // Ciphertext is arbitrary bytes: NUL, invalid UTF-8, line breaks.
+        const std::string ciphertext("\0\xff\n:ciphertext", 14);
+        {
+            MessageBatcher batcher(db, 16, std::chrono::milliseconds(5));
+            std::vector<int> batchedIds(16, -1);
+            std::vector<std::thread> senders;
+            for (int i = 0; i < 16; ++i) {
+                senders.emplace_back([&, i] {
+                    const std::string body = i % 2 ? "batched \"quoted\" \\ body" : "batched, {braces}";
+                    batchedIds[i] = batcher.insert(PostgresDatabase::NewMessage{
+                        userAId, userBId, body, i % 4 == 0, ciphertext, "pub"});
+                });
+            }
+            for (auto& t : senders) {
+                t.join();
+            }
+            bool distinct = true;
+            for (int i = 0; i < 16; ++i) {
+                for (int j = i + 1; j < 16; ++j) {
+                    distinct &= batchedIds[i] != batchedIds[j];
+                }
+                distinct &= batchedIds[i] > 0;
+            }
+            allOk &= ensure(distinct, "MessageBatcher returns a distinct id per caller");
+            allOk &= ensure(batcher.stats().batches < 16, "MessageBatcher groups concurrent inserts");
+        }
+        {
+            int e2eRows = 0;
+            bool intact = true;
+            db.streamMessagesBetween(userAId, userBId, 16, PostgresDatabase::MessageCursor(),
+                [&](const PostgresDatabase::MessageRowView& row) {
+                    if (row.e2ePayload) {
+                        ++e2eRows;
+                        intact &= *row.e2ePayload == ciphertext;
+                    }
+                });
+            allOk &= ensure(e2eRows == 4 && intact, "E2E payloads come back as the bytes stored");
+        }
+
+        std::vector<int> latest = pageIds(db, userAId, userBId, 1, PostgresDatabase::MessageCursor());
+        allOk &= ensure(latest.size() == 1, "streamMessagesBetween newest page via cursor");
+        if (!latest.empty()) {
+            PostgresDatabase::MessageCursor older;
+            older.beforeId = latest[0];
+            std::vector<int> previous = pageIds(db, userAId, userBId, 50, older);
+            bool allOlder = !previous.empty();
+            for (size_t i = 0; i < previous.size(); ++i) {
+                allOlder &= previous[i] < older.beforeId && (i == 0 || previous[i - 1] < previous[i]);
+            }
+            allOk &= ensure(allOlder, "streamMessagesBetween before_id returns only older messages, oldest first");
+
+            PostgresDatabase::MessageCursor newer;
+            newer.afterId = older.beforeId;
+            allOk &= ensure(pageIds(db, userAId, userBId, 50, newer).empty(),
+                            "streamMessagesBetween after_id of newest is empty");
+        }
+
+        auto unreadFrom = [&db, userBId](bool byRecency) {
+            for (auto row : db.getChatsWithUnreadCounts(userBId, byRecency)) {
+                if (row["username"].as<std::string>() == "test_user_a") {
+                    return row["unread_count"].as<int>();
+                }
+            }
+            return -1;
+        };
+        allOk &= ensure(unreadFrom(false) > 0, "chat summary counts unread messages");
+        allOk &= ensure(unreadFrom(true) == unreadFrom(false), "chat summary recency order lists the same chat");
+        std::vector<int> newestPage = pageIds(db, userBId, userAId, 1, PostgresDatabase::MessageCursor());
+        if (!newestPage.empty()) {
+            db.markMessagesReadUpTo({{userBId, userAId, newestPage[0]}});
+        }
+        allOk &= ensure(unreadFrom(false) == 0, "chat summary unread cleared up to the newest message");
+
+        {
+            const int first = db.insertMessage(userAId, userBId, "receipt one");
+            const int second = db.insertMessage(userAId, userBId, "receipt two");
+            const int third = db.insertMessage(userAId, userBId, "receipt three");
+            ReadReceiptWriter receipts(db, std::chrono::milliseconds(50));
+            receipts.markRead(userBId, userAId, first);
+            receipts.markRead(userBId, userAId, second);
+            receipts.stop();
+            allOk &= ensure(receipts.stats().flushes == 1 && receipts.stats().receipts == 1,
+                            "ReadReceiptWriter coalesces receipts for one chat");
+            allOk &= ensure(unreadFrom(false) == 1, "read receipt up to an id leaves newer messages unread");
+            allOk &= ensure(db.markMessagesReadUpTo({{userBId, userAId, third}}) == 1,
+                            "markMessagesReadUpTo marks only unread messages");
+            allOk &= ensure(unreadFrom(false) == 0, "chat summary unread cleared by markMessagesReadUpTo");
+        }
+
+        PostgresDatabase::AvatarUpdate update = db.updateAvatar(userAId, "hi", "image/png");
+        allOk &= ensure(std::find(update.partnerIds.begin(), update.partnerIds.end(), userBId) != update.partnerIds.end(),
+                        "updateAvatar returns chat partners");
+        allOk &= ensure(update.hash.size() == 64, "updateAvatar stores the avatar under its SHA-256");
+        allOk &= ensure(db.setUserAvatar(userBId, "hi", "image/png") == update.hash,
+                        "identical avatars share one content hash");
+        pqxx::result profile = db.getUserProfile(userAId, "test_user_a");
+        allOk &= ensure(!profile.empty() && profile[0]["avatar_hash"].as<std::string>() == update.hash &&
+                        profile[0]["avatar_mime"].as<std::string>() == "image/png",
+                        "profile carries the avatar hash and mime");
+        pqxx::result fresh = db.getAvatar(userAId, "test_user_a", "");
+        allOk &= ensure(!fresh.empty() && fresh[0]["data"].as<std::basic_string<std::byte>>() ==
+                            std::basic_string<std::byte>{std::byte{'h'}, std::byte{'i'}},
+                        "getAvatar returns the bytes for a stale hash");
+        pqxx::result cached = db.getAvatar(userAId, "test_user_a", update.hash);
+        allOk &= ensure(!cached.empty() && cached[0]["data"].is_null(),
+                        "getAvatar omits the bytes for the current hash");
+
+        PostgresDatabase::PartitionMaintenance maintenance = db.maintainMessagePartitions(3);
+        allOk &= ensure(maintenance.created >= 0 && maintenance.dropped == 0,
+                        "partition maintenance keeps every month without a retention period");
+        allOk &= ensure(db.maintainMessagePartitions(3).created == 0,
+                        "partition maintenance is idempotent");
+
+        allOk &= ensure(ReplicaRouter::parseLsn("16/B374D848") == 0x16B374D848ULL, "parseLsn reads pg_lsn text");
+
+        // Replica routing needs a streaming replica of the same database,
+        // given as argv[2] or PGREPLICA.
+        const char* replicaEnv = std::getenv("PGREPLICA");
+        const std::string replicaConn = argc > 2 ? argv[2] : (replicaEnv ? replicaEnv : "");
+        if (!replicaConn.empty()) {
+            PostgresDatabase routed(connstr, 2, {replicaConn});
+            const int written = routed.insertMessage(userAId, userBId, "replica read-your-writes");
+            std::vector<int> own = pageIds(routed, userAId, userBId, 1, PostgresDatabase::MessageCursor());
+            allOk &= ensure(!own.empty() && own[0] == written,
+                            "writer reads its own message with replicas configured");
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            inboxSize(routed, userBId);
+            allOk &= ensure(routed.replicaStats().replicaReads > 0, "caught-up reads are served by the replica");
+        } else {
+            std::cout << "[TEST] SKIP: replica routing (set PGREPLICA)" << std::endl;
+        }
 
-        pqxx::result inbox = db.getInbox(userBId, 50, 0);
-        allOk &= ensure(!inbox.empty(), "getInbox(userB)");
+        PostgresConnectionPool::Stats poolStats = db.poolStats();
+        allOk &= ensure(poolStats.idle == poolStats.size, "pool connections returned after use");
 
         if (allOk) {
             std::cout << "[TEST] All checks passed." << std::endl;
@@ -1,13 +1,31 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include <iostream>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
+struct MessageRecord {
+    int id;
+    int senderId;
+    bool isRead;
+    std::string body;
+    std::string e2ePayload;
+    std::string e2ePub;
+};
+
+// Keyset position in a conversation; 0 means unset. beforeId pages back
+// through history, afterId fetches what arrived since a known message.
+struct MessageCursor {
+    int beforeId = 0;
+    int afterId = 0;
+};
+
 class MessengerClient {
 public:
     MessengerClient(const std::string& host, int port);
@@ -17,6 +35,11 @@ public:
     void disconnect();
     bool isConnected() const;
 
+    // Switches this connection to length-prefixed binary frames. Returns
+    // false (and stays on the line protocol) if the server refuses.
+    bool enableBinaryProtocol();
+    bool isBinaryProtocol() const { return binary_; }
+
     // Auth
     std::string registerUser(const std::string& username, const std::string& password);
     std::string login(const std::string& username, const std::string& password);
@@ -25,6 +48,11 @@ public:
     // Messages
     std::string sendMessage(const std::string& to, const std::string& body);
     std::string getMessages(const std::string& contact, int limit = 50, int offset = 0);
+    std::string getMessages(const std::string& contact, std::vector<MessageRecord>& records,
+                            int limit = 50, int offset = 0);
+    std::string getMessages(const std::string& contact, const MessageCursor& cursor, int limit = 50);
+    std::string getMessages(const std::string& contact, std::vector<MessageRecord>& records,
+                            const MessageCursor& cursor, int limit = 50);
     std::string getInbox(int limit = 20, int offset = 0);
 
     // Session
@@ -39,9 +67,19 @@ private:
     std::string sessionId_;
     int userId_;
     std::string recvBuffer_;
+    bool binary_;
 
-    std::string sendCommand(const std::string& cmd);
+    std::string sendCommand(const std::string& cmd, const std::unordered_map<std::string, std::string>& params);
+    std::string sendFrame(const std::string& frame, std::string& body);
+    std::unordered_map<std::string, std::string> messageParams(const std::string& contact, int limit, int offset,
+                                                               const MessageCursor& cursor) const;
+    std::string fetchMessages(const std::unordered_map<std::string, std::string>& params,
+                              std::vector<MessageRecord>& records);
+    static void parseMessageFrame(const std::string& body, std::vector<MessageRecord>& records,
+                                  uint32_t& resumeAfter);
     std::string buildCommand(const std::string& cmd, const std::unordered_map<std::string, std::string>& params);
+    std::string buildFrame(const std::string& cmd, const std::unordered_map<std::string, std::string>& params);
     bool sendAll(const std::string& data);
     bool readLine(std::string& line);
+    bool readFrame(std::string& body);
 };
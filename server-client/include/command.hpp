@@ -0,0 +1,34 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+#include "protocol.hpp"
+
+// One slot per request field id (FieldId::SessionId .. FieldId::Hash).
+constexpr size_t kRequestFieldSlots = static_cast<size_t>(FieldId::Hash) + 1;
+
+// A parsed request. Field values are views into the request buffer, which
+// must outlive the Command; a missing field reads as an empty view.
+struct Command {
+    uint8_t opcode = 0;
+    WireFormat format = WireFormat::Text;
+    std::array<std::string_view, kRequestFieldSlots> fields{};
+
+    std::string_view get(FieldId id) const {
+        return fields[static_cast<size_t>(id)];
+    }
+
+    // Integer field value, or fallback when missing or malformed. Negative
+    // text values clamp to 0.
+    int getInt(FieldId id, int fallback) const;
+};
+
+// "CMD key=value ... body=rest of line". Unknown keys are skipped; an
+// unknown command leaves opcode at 0. Never allocates.
+void parseTextCommand(std::string_view line, Command& out);
+
+// Frame body as described in protocol.hpp. Returns false for malformed
+// frames and unknown opcodes. Never allocates.
+bool parseFrameCommand(std::string_view body, Command& out);
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include "recv_buffer.hpp"
+#include "protocol.hpp"
+
+class EventLoop;
+
+// What to do when a subscriber's event queue is full.
+enum class SlowConsumerPolicy {
+    DropOldest,
+    Disconnect
+};
+
+// One request as it came off the wire: a text line, or the body of a binary
+// frame once the connection has switched with "PROTO mode=binary".
+struct InboundRequest {
+    WireFormat format;
+    std::string data;
+};
+
+// A non-blocking client socket owned by one EventLoop. The loop thread is the
+// only reader; any thread may queue output and flush it. Parsed requests wait
+// in a per-connection queue so that at most one worker runs them, in order.
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+    enum class ReadStatus {
+        Drained,   // socket returned EAGAIN, wait for the next edge
+        Partial,   // read budget used up, more data may be pending
+        EndOfInput,// peer shut down its side; it may still read our replies
+        Closed     // the socket failed
+    };
+
+    static constexpr size_t kMaxMessageSize = 1024 * 1024;
+    static constexpr size_t kMaxPendingRequests = 256;
+
+    enum class EventStatus {
+        Queued,
+        DroppedOldest,
+        Overflow      // queue full under SlowConsumerPolicy::Disconnect
+    };
+
+    Connection(int fd, EventLoop* loop);
+    ~Connection();
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    int fd() const { return fd_; }
+    EventLoop* loop() const { return loop_; }
+
+    ReadStatus readAvailable();
+    // Splits the next request off the input; an upgrade line switches the
+    // parser to binary frames before any later byte is looked at.
+    bool nextRequest(InboundRequest& request);
+    bool requestTooLarge() const;
+
+    // Returns true when the caller must schedule a worker for this connection.
+    // Reading pauses once kMaxPendingRequests requests are waiting.
+    bool enqueueRequest(InboundRequest&& request);
+    bool takeRequests(std::vector<InboundRequest>& out, bool& resumeReading);
+    void cancelScheduling(std::vector<InboundRequest>& dropped);
+    bool isReadPaused() const { return readPaused_; }
+    // After the peer's EOF nothing more is read. The connection can close
+    // once inputDone() and its output has been written.
+    void endInput();
+    bool inputDone();
+
+    // Queued output goes out with one sendmsg per flush where it fits in
+    // kMaxIovecs segments. Small responses are packed into the tail segment.
+    void queueResponse(std::string response);
+    void queueFrame(std::string frame);
+    // Queues the PROTO ack and switches events to binary frames under one
+    // hold of the output lock, so no text event can be written after it.
+    // Responses follow the format of their request.
+    void upgradeEvents(std::string ack);
+    // Events wait in their own bounded queue and are written between
+    // responses once the response bytes already queued have been sent.
+    EventStatus queueEvent(const std::shared_ptr<const std::string>& payload,
+                           size_t maxQueued, SlowConsumerPolicy policy);
+    bool flush();
+    bool hasPendingOutput();
+    // Bytes queued for the socket, not counting events.
+    size_t pendingOutputBytes();
+
+    // A response queued in pieces across several flushes. Events are held
+    // back until it ends so that none is written into the middle of it.
+    void beginStreamedResponse();
+    void endStreamedResponse();
+
+    void markClosed();
+    bool isClosed() const { return closed_; }
+
+    void setSubscribed(bool subscribed) { subscribed_ = subscribed; }
+    bool isSubscribed() const { return subscribed_; }
+
+private:
+    // One queued write: either bytes the connection owns, or an event
+    // payload shared with every other subscriber.
+    struct OutSegment {
+        std::string owned;
+        std::shared_ptr<const std::string> shared;
+
+        const char* data() const { return shared ? shared->data() : owned.data(); }
+        size_t size() const { return shared ? shared->size() : owned.size(); }
+    };
+
+    static constexpr size_t kMaxIovecs = 64;
+
+    void appendOutputLocked(std::string bytes);
+
+    int fd_;
+    EventLoop* loop_;
+    RecvBuffer inBuffer_;
+    WireFormat inputFormat_;
+    bool frameTooLarge_;
+
+    std::mutex requestsMutex_;
+    std::deque<InboundRequest> pendingRequests_;
+    bool scheduled_;
+    bool inputEnded_;
+    std::atomic<bool> readPaused_;
+
+    std::mutex outMutex_;
+    std::deque<OutSegment> out_;
+    size_t outOffset_;          // bytes of out_.front() already sent
+    WireFormat eventFormat_;
+    std::deque<std::shared_ptr<const std::string>> events_;
+    bool streaming_;
+
+    std::atomic<bool> closed_;
+    std::atomic<bool> subscribed_;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include "connection.hpp"
+
+// Edge-triggered epoll reactor. Each loop owns a set of client sockets and
+// runs on its own thread; complete requests are handed to onRequest.
+class EventLoop {
+public:
+    using RequestHandler = std::function<void(const std::shared_ptr<Connection>&, InboundRequest&&)>;
+    using CloseHandler = std::function<void(const std::shared_ptr<Connection>&)>;
+
+    EventLoop(RequestHandler onRequest, CloseHandler onClose);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    void start();
+    void stop();
+
+    // Takes ownership of an accepted socket. Safe to call from any thread.
+    bool addConnection(int fd);
+    // Takes ownership of a listening socket and accepts from it on this
+    // loop's thread; used by SO_REUSEPORT shards. Call before start().
+    bool addListener(int fd);
+    // Restricts the loop thread to one CPU. Call after start().
+    bool pinToCpu(int cpu);
+    size_t connectionCount() const;
+
+    // Continues reading a connection whose request queue had filled up.
+    void resumeReading(const std::shared_ptr<Connection>& conn);
+    // Has the loop thread write out whatever the connection has queued, and
+    // close it if the peer has hung up and every request has been answered.
+    void requestFlush(const std::shared_ptr<Connection>& conn);
+
+private:
+    int epollFd_;
+    int wakeFd_;
+    int listenFd_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+
+    RequestHandler onRequest_;
+    CloseHandler onClose_;
+
+    mutable std::mutex connectionsMutex_;
+    std::unordered_map<int, std::shared_ptr<Connection>> connections_;
+
+    std::mutex pendingMutex_;
+    std::vector<std::shared_ptr<Connection>> resumeQueue_;
+    std::vector<std::shared_ptr<Connection>> flushQueue_;
+
+    void run();
+    void wake();
+    void drainPending();
+    void acceptPending();
+    void handleReadable(const std::shared_ptr<Connection>& conn);
+    void flushOrClose(const std::shared_ptr<Connection>& conn);
+    void closeConnection(const std::shared_ptr<Connection>& conn);
+    std::shared_ptr<Connection> findConnection(int fd);
+};
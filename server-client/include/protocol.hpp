@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Binary framing negotiated with "PROTO mode=binary". Every frame is
+//
+//   u32 length            bytes that follow, big-endian
+//   u8  opcode
+//   fields...             u8 field id, u32 value length, value bytes
+//
+// Integer fields carry a 4-byte big-endian value; everything else is raw
+// bytes, so bodies may contain newlines and E2E payloads need no base64.
+
+enum class WireFormat : uint8_t {
+    Text,
+    Binary
+};
+
+enum class Opcode : uint8_t {
+    Register = 1,
+    Login = 2,
+    Logout = 3,
+    Send = 4,
+    SendE2e = 5,
+    GetMessages = 6,
+    GetMessagesE2e = 7,
+    GetChats = 8,
+    GetProfile = 9,
+    SetAvatar = 10,
+    SetE2ePub = 11,
+    GetInbox = 12,
+    DeleteChat = 13,
+    Subscribe = 14,
+    Stats = 15,
+    Proto = 16,
+    GetAvatar = 17,
+
+    Response = 0x80,
+    Event = 0x81
+};
+
+enum class FieldId : uint8_t {
+    SessionId = 1,
+    Username = 2,
+    Password = 3,
+    To = 4,
+    Body = 5,
+    E2e = 6,
+    E2ePub = 7,
+    Contact = 8,
+    Limit = 9,
+    Offset = 10,
+    Data = 11,
+    Mime = 12,
+    Pub = 13,
+    BeforeId = 14,
+    AfterId = 15,
+    Order = 16,
+    Hash = 17,
+
+    // Response fields
+    Text = 32,          // status line, same text as the line protocol
+    MessageId = 33,
+    SenderId = 34,
+    IsRead = 35
+};
+
+constexpr size_t kFrameHeaderSize = 4;
+constexpr size_t kMaxFrameSize = 1024 * 1024;
+
+extern const char* const kBinaryUpgradeRequest;
+extern const char* const kBinaryUpgradeResponse;
+
+bool isBinaryUpgradeRequest(std::string_view line);
+
+// Text replies and events are one line each, but values reach the server
+// from binary frames with any bytes in them. Line breaks become spaces where
+// text goes out, so no value can end a line early or forge the next one.
+bool breaksLine(std::string_view text);
+void appendLineSafe(std::string& out, std::string_view text);
+void makeLineSafe(std::string& line);
+
+// Name tables shared by the text and binary dispatch paths. Lookups return
+// nullptr / false for unknown values and never allocate.
+const char* commandName(uint8_t opcode);
+bool commandOpcode(std::string_view name, uint8_t& opcode);
+const char* fieldName(uint8_t fieldId);
+bool fieldIdForName(std::string_view name, uint8_t& fieldId);
+bool isIntegerField(uint8_t fieldId);
+
+struct FrameField {
+    uint8_t id;
+    const char* data;
+    uint32_t size;
+
+    uint32_t asU32() const;
+    std::string asString() const { return std::string(data, size); }
+};
+
+// Builds one frame; finish() patches in the length prefix.
+class FrameWriter {
+public:
+    explicit FrameWriter(Opcode opcode);
+
+    FrameWriter& add(FieldId field, const std::string& value);
+    FrameWriter& add(FieldId field, const char* data, size_t size);
+    FrameWriter& addU32(FieldId field, uint32_t value);
+    FrameWriter& addRaw(uint8_t field, const char* data, size_t size);
+
+    std::string finish();
+
+    // Bytes the length prefix will count, i.e. what kMaxFrameSize limits.
+    size_t size() const { return buffer_.size() - kFrameHeaderSize; }
+    // What add() of a valueSize-byte value adds to size().
+    static constexpr size_t fieldSize(size_t valueSize) { return 1 + 4 + valueSize; }
+
+private:
+    std::string buffer_;
+};
+
+// Reads the big-endian length prefix at data[0..3].
+uint32_t readFrameLength(const char* data);
+
+// Parses a frame body (everything after the length prefix). Field pointers
+// refer into body, which must outlive them.
+bool parseFrameBody(const std::string& body, uint8_t& opcode, std::vector<FrameField>& fields);
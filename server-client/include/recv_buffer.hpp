@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+// Growable ring buffer for one connection's inbound bytes. Reads land
+// directly in the free space (up to two segments via readv), and the newline
+// scan resumes where the previous one stopped, so pipelined input is examined
+// once instead of once per extracted line.
+class RecvBuffer {
+public:
+    explicit RecvBuffer(size_t initialCapacity = 16 * 1024);
+
+    // One readv into the free space, growing first if less than minRead bytes
+    // are free. Returns bytes read, 0 on EOF, or -1 with errno set.
+    ssize_t readFrom(int fd, size_t minRead);
+
+    bool nextLine(std::string& line);
+
+    // Extracts one length-prefixed frame body (the bytes after the 4-byte
+    // prefix). Sets tooLarge when the prefix announces more than maxFrame.
+    bool nextFrame(std::string& body, size_t maxFrame, bool& tooLarge);
+
+    size_t size() const { return static_cast<size_t>(tail_ - head_); }
+    size_t capacity() const { return buffer_.size(); }
+
+    // Bytes buffered after the last complete line; only meaningful after
+    // nextLine() has returned false.
+    size_t partialLineLength() const { return size(); }
+
+private:
+    std::vector<char> buffer_;
+    size_t initialCapacity_;
+    uint64_t head_;
+    uint64_t tail_;
+    uint64_t scanned_;
+
+    size_t mask() const { return buffer_.size() - 1; }
+    void grow(size_t minFree);
+    void copyOut(uint64_t from, size_t length, std::string& out) const;
+};
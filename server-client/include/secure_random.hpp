@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Kernel randomness for session ids and nonces. Each thread keeps a
+// kBufferBytes block filled by one getrandom() call and hands it out in
+// small pieces, so generating an id is a copy and a hex pass rather than a
+// syscall. Bytes are wiped from the block as they are handed out.
+class SecureRandom {
+public:
+    static constexpr size_t kBufferBytes = 4096;
+
+    static void fill(void* out, size_t size);
+
+    // 2 * bytes lowercase hex digits.
+    static std::string hex(size_t bytes);
+    static void hex(char* out, size_t bytes);
+};
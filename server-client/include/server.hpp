@@ -3,12 +3,14 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <vector>
 #include <memory>
 #include <iostream>
 #include <sstream>
 #include <unordered_map>
 #include <unordered_set>
+#include <condition_variable>
 
 #if __has_include("postgresql.hpp")
 #include "postgresql.hpp"
@@ -25,59 +27,163 @@
 #else
 #error "password_hash.hpp not found. Add database/include to include paths."
 #endif
+#if __has_include("message_batcher.hpp")
+#include "message_batcher.hpp"
+#elif __has_include("../../database/include/message_batcher.hpp")
+#include "../../database/include/message_batcher.hpp"
+#else
+#error "message_batcher.hpp not found. Add database/include to include paths."
+#endif
+#if __has_include("read_receipt_writer.hpp")
+#include "read_receipt_writer.hpp"
+#elif __has_include("../../database/include/read_receipt_writer.hpp")
+#include "../../database/include/read_receipt_writer.hpp"
+#else
+#error "read_receipt_writer.hpp not found. Add database/include to include paths."
+#endif
 #include "session.hpp"
+#include "connection.hpp"
+#include "event_loop.hpp"
+#include "worker_pool.hpp"
+#include "protocol.hpp"
+#include "command.hpp"
+#include "user_cache.hpp"
+
+struct ServerConfig {
+    int port = 5555;
+    int ioThreads = 2;
+    int listenBacklog = 1024;
+    int workerThreads = 8;
+    int maxQueuedJobs = 1024;
+    int dbPoolSize = 8;
+    // Streaming replicas for read-only queries, each with its own pool of
+    // dbPoolSize connections. Replicas further behind the primary than
+    // replicaMaxLagKb are not read from.
+    std::vector<std::string> dbReplicas;
+    int replicaMaxLagKb = 16 * 1024;
+    int maxQueuedEvents = 256;
+    SlowConsumerPolicy slowConsumerPolicy = SlowConsumerPolicy::DropOldest;
+    // 0 keeps one listener and accept thread feeding ioThreads loops. N > 0
+    // opens N SO_REUSEPORT listeners, each accepted by its own loop.
+    int acceptShards = 0;
+    // Group commit for SEND: up to sendBatchSize rows, or whatever arrives
+    // within sendBatchDelayUs of the first, share one INSERT. A batch size
+    // of 1 inserts each message on its own.
+    int sendBatchSize = 64;
+    int sendBatchDelayUs = 500;
+    // GET_MESSAGES only records what was read; the writer marks messages
+    // read in the database at most this long after the first such read.
+    int readReceiptDelayMs = 200;
+    // Messages older than this many days are hidden and their monthly
+    // partitions dropped; 0 keeps everything. Maintenance also keeps
+    // partitionMonthsAhead months of partitions created in advance.
+    int messageRetentionDays = 0;
+    int partitionMonthsAhead = 3;
+    int partitionMaintenanceMinutes = 60;
+    // Usernames whose ids are kept in memory; 0 looks every one up.
+    int userCacheSize = 100000;
+    // Sessions expire this long after login; a background reaper drops them.
+    int sessionTtlSeconds = 3600;
+    // Non-empty: sessions are HMAC-signed tokens under this secret, valid
+    // on every server that shares it.
+    std::string sessionSecret;
+    // Pins I/O loop i to cpus[i % cpus.size()], or to CPU i modulo the core
+    // count when cpus is empty.
+    bool pinCpus = false;
+    std::vector<int> cpus;
+};
 
 class MessengerServer {
 public:
     MessengerServer(const std::string& dbConnStr, int port = 5555);
+    MessengerServer(const std::string& dbConnStr, const ServerConfig& config);
     ~MessengerServer();
 
     void start();
     void stop();
     bool isRunning() const;
+    size_t pendingJobs() const;
 
 private:
-    int port_;
+    ServerConfig config_;
     int serverSocket_;
-    bool running_;
+    std::atomic<bool> running_;
     std::thread acceptThread_;
-    std::vector<std::thread> clientThreads_;
-    std::mutex threadsMutex_;
+    std::thread maintenanceThread_;
+    std::mutex maintenanceMutex_;
+    std::condition_variable maintenanceCv_;
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    size_t nextLoop_;
     std::mutex subscribersMutex_;
-    std::mutex recvBuffersMutex_;
+    std::atomic<uint64_t> eventsDropped_;
+    std::atomic<uint64_t> slowConsumersDisconnected_;
+    WorkerPool workers_;
 
     PostgresDatabase db_;
+    std::unique_ptr<MessageBatcher> sendBatcher_;
+    std::unique_ptr<ReadReceiptWriter> readReceipts_;
     SessionManager sessionMgr_;
+    UserCache userCache_;
 
     std::unordered_map<int, int> socketToUser_;
-    std::unordered_map<int, std::unordered_set<int>> userToSockets_;
-    std::unordered_map<int, std::string> recvBuffers_;
+    std::unordered_map<int, std::unordered_map<int, std::shared_ptr<Connection>>> userToConnections_;
 
+    int openListener(bool reusePort);
     void acceptConnections();
-    void handleClient(int clientSocket);
-    void sendMessage(int sock, const std::string& response);
-    std::string receiveMessage(int sock);
+    void runMaintenance();
+    void onRequest(const std::shared_ptr<Connection>& conn, InboundRequest&& request);
+    void processRequests(const std::shared_ptr<Connection>& conn);
+    void handleRequest(const std::shared_ptr<Connection>& conn, const InboundRequest& request);
+    void reply(const std::shared_ptr<Connection>& conn, WireFormat format, std::string response);
+    void handleDisconnect(const std::shared_ptr<Connection>& conn);
     
     // Protocol handlers
     std::string handleRegister(const std::string& username, const std::string& password);
     std::string handleLogin(const std::string& username, const std::string& password);
     std::string handleLogout(const std::string& sessionId);
     std::string handleSendMessage(const std::string& sessionId, const std::string& receiverUsername, const std::string& body);
-    std::string handleSendMessageE2e(const std::string& sessionId, const std::string& receiverUsername, const std::string& body, const std::string& e2ePayload, const std::string& e2ePub);
-    std::string handleGetMessages(const std::string& sessionId, const std::string& contactUsername, int limit = 50, int offset = 0);
+    std::string handleSendMessageE2e(const std::string& sessionId, const std::string& receiverUsername, WireFormat format,
+                                     const std::string& e2ePayload, const std::string& e2ePub);
+    // A page is picked by before_id/after_id when either is given, else by
+    // offset (older clients), else it is the newest page.
+    struct MessagePage {
+        int limit = 50;
+        int offset = 0;
+        PostgresDatabase::MessageCursor cursor;
+    };
+    void handleGetMessages(const std::shared_ptr<Connection>& conn, const std::string& sessionId,
+                           const std::string& contactUsername, const MessagePage& page);
+    std::string handleGetMessagesFrame(const std::string& sessionId, const std::string& contactUsername, const MessagePage& page);
+    std::string loadMessages(const std::string& sessionId, const std::string& contactUsername, const MessagePage& page,
+                             const PostgresDatabase::MessageRowFn& onRow);
     std::string handleSearchUsers(const std::string& query);
-    std::string handleGetChats(const std::string& sessionId);
+    std::string handleGetChats(const std::string& sessionId, bool byRecency = false);
     std::string handleGetProfile(const std::string& username);
-    std::string handleSetAvatar(const std::string& sessionId, const std::string& avatarB64, const std::string& avatarMime);
+    struct AvatarReply {
+        std::string hash;
+        std::string mime;
+        std::string data;
+        bool notModified = false;
+    };
+    std::string handleGetAvatar(const std::string& username, const std::string& cachedHash);
+    std::string handleGetAvatarFrame(const std::string& username, const std::string& cachedHash);
+    std::string loadAvatar(const std::string& username, const std::string& cachedHash, AvatarReply& avatar);
+    std::string handleSetAvatar(const std::string& sessionId, WireFormat format,
+                                const std::string& avatarData, const std::string& avatarMime);
     std::string handleSetE2ePub(const std::string& sessionId, const std::string& e2ePub);
-    std::string handleGetInbox(const std::string& sessionId, int limit = 20, int offset = 0);
+    void handleGetInbox(const std::shared_ptr<Connection>& conn, WireFormat format, const std::string& sessionId,
+                        int limit = 20, int offset = 0);
     std::string handleDeleteChat(const std::string& sessionId, const std::string& contactUsername);
-    std::string handleSubscribe(const std::string& sessionId, int clientSocket);
+    std::string handleSubscribe(const std::string& sessionId, const std::shared_ptr<Connection>& conn);
+    std::string handleStats();
+
+    int storeMessage(PostgresDatabase::NewMessage message);
+    // Resolves a username through userCache_; returns 0 for unknown users.
+    int lookupUserId(const std::string& username);
 
-    void registerSubscriber(int clientSocket, int userId);
-    void unregisterSubscriber(int clientSocket);
+    void registerSubscriber(const std::shared_ptr<Connection>& conn, int userId);
+    void unregisterSubscriber(const std::shared_ptr<Connection>& conn);
     void notifyUsers(const std::vector<int>& userIds, const std::string& payload);
 
     // Helper
-    bool parseCommand(const std::string& data, std::string& cmd, std::unordered_map<std::string, std::string>& params);
 };
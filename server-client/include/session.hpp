@@ -1,40 +1,107 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
-#include <chrono>
+#include <vector>
+#include "session_token.hpp"
 
 class Session {
 public:
     Session(int userId, const std::string& username, const std::string& sessionId)
-        : userId_(userId), username_(username), sessionId_(sessionId),
-          createdAt_(std::chrono::system_clock::now()) {}
+        : userId_(userId), username_(username), sessionId_(sessionId) {}
 
     int getUserId() const { return userId_; }
     const std::string& getUsername() const { return username_; }
     const std::string& getSessionId() const { return sessionId_; }
-    
-    bool isExpired(int expirySeconds = 3600) const {
-        auto now = std::chrono::system_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - createdAt_);
-        return duration.count() > expirySeconds;
-    }
 
 private:
     int userId_;
     std::string username_;
     std::string sessionId_;
-    std::chrono::system_clock::time_point createdAt_;
 };
 
+// Session table shared by every worker. Ids are spread over kShards
+// independently locked maps, so lookups from different workers rarely
+// contend and each map stays small however many sessions there are.
+//
+// Sessions are handed out as shared_ptr handles: a handler keeps a valid
+// Session even if it is logged out or reaped while the handler runs.
+//
+// A session expires ttl after it is created. Lookups never return an
+// expired one; a reaper thread removes them in the background so that
+// abandoned sessions do not pile up. Each shard files its ids on a hashed
+// timing wheel of kWheelSlots slots, ttl / kWheelSlots apart, and the
+// reaper visits one slot per tick instead of scanning the whole table.
+//
+// With a token secret, new sessions are signed SessionTokens instead of
+// table entries: validating one is an HMAC check, any node sharing the
+// secret accepts it, and it outlives a restart. Table ids issued earlier
+// keep working until they expire.
 class SessionManager {
 public:
+    struct Stats {
+        size_t active;      // table sessions; tokens are not stored
+        uint64_t created;
+        uint64_t reaped;
+        size_t revoked;     // logged-out tokens not yet expired
+    };
+
+    explicit SessionManager(std::chrono::seconds ttl = std::chrono::seconds(3600),
+                            std::string tokenSecret = std::string());
+    ~SessionManager();
+
+    SessionManager(const SessionManager&) = delete;
+    SessionManager& operator=(const SessionManager&) = delete;
+
     std::string createSession(int userId, const std::string& username);
     bool verifySession(const std::string& sessionId);
-    Session* getSession(const std::string& sessionId);
+    std::shared_ptr<const Session> getSession(const std::string& sessionId);
     void removeSession(const std::string& sessionId);
 
+    Stats stats() const;
+
 private:
-    std::unordered_map<std::string, Session*> sessions_;
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t kShards = 64;
+    static constexpr size_t kWheelSlots = 64;
+
+    struct Entry {
+        std::shared_ptr<const Session> session;
+        Clock::time_point expiresAt;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Entry> sessions;
+        std::array<std::vector<std::string>, kWheelSlots> wheel;
+    };
+
+    const std::chrono::seconds ttl_;
+    const Clock::duration tick_;
+    const Clock::time_point epoch_;
+    std::array<Shard, kShards> shards_;
+    SessionTokens tokens_;
+
+    std::atomic<uint64_t> created_;
+    std::atomic<uint64_t> reaped_;
+
+    std::mutex reaperMutex_;
+    std::condition_variable reaperCv_;
+    bool running_;
+    std::thread reaper_;
+
+    Shard& shardFor(const std::string& sessionId);
+    size_t slotFor(Clock::time_point when) const;
+    void reap();
     std::string generateSessionId();
 };
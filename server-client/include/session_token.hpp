@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Signed, self-describing session ids:
+//
+//   t1.<userId>.<expiry unix seconds>.<nonce>.<base64url username>.<base64url HMAC-SHA256>
+//
+// The MAC covers everything before the last dot, so any node holding the
+// same secret can check a token without a session table and it survives a
+// restart. None of the characters collide with the text protocol's
+// separators.
+//
+// LOGOUT cannot take a token back from the client, so revoked tokens are
+// remembered, by signature, until they would have expired anyway. The set
+// is per process; other nodes keep accepting a revoked token until expiry.
+class SessionTokens {
+public:
+    using Clock = std::chrono::system_clock;
+
+    struct Claims {
+        int userId;
+        std::string username;
+        Clock::time_point expiresAt;
+    };
+
+    // An empty secret disables tokens.
+    explicit SessionTokens(std::string secret);
+
+    SessionTokens(const SessionTokens&) = delete;
+    SessionTokens& operator=(const SessionTokens&) = delete;
+
+    bool enabled() const { return !secret_.empty(); }
+    static bool isToken(const std::string& sessionId);
+
+    std::string issue(int userId, const std::string& username, Clock::time_point expiresAt,
+                      const std::string& nonce) const;
+    // False for a bad signature, a malformed or expired token, or one that
+    // has been revoked.
+    bool verify(const std::string& token, Claims& claims) const;
+
+    void revoke(const std::string& token);
+    void purgeRevoked();
+    size_t revokedCount() const;
+
+private:
+    std::string secret_;
+
+    mutable std::mutex revokedMutex_;
+    std::unordered_map<std::string, Clock::time_point> revoked_;   // signature -> expiry
+
+    std::string sign(const char* data, size_t size) const;
+    bool checkSignature(const std::string& token, Claims& claims, std::string& signature) const;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Bounded username -> user id cache in front of the users table. Usernames
+// are never renamed or reused, so an entry stays valid until it is evicted;
+// only ids that exist are cached, never misses. Keys are spread over
+// kShards independently locked LRU lists so lookups from different workers
+// rarely contend.
+class UserCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t size;
+        size_t capacity;
+    };
+
+    // A capacity of 0 disables the cache: every lookup misses.
+    explicit UserCache(size_t capacity);
+
+    UserCache(const UserCache&) = delete;
+    UserCache& operator=(const UserCache&) = delete;
+
+    bool enabled() const { return capacity_ > 0; }
+
+    bool lookup(const std::string& username, int& userId);
+    void insert(const std::string& username, int userId);
+    void invalidate(const std::string& username);
+
+    Stats stats() const;
+
+private:
+    static constexpr size_t kShards = 16;
+
+    struct Shard {
+        mutable std::mutex mutex;
+        // Most recently used at the front.
+        std::list<std::pair<std::string, int>> lru;
+        std::unordered_map<std::string, std::list<std::pair<std::string, int>>::iterator> index;
+    };
+
+    size_t capacity_;
+    size_t shardCapacity_;
+    std::array<Shard, kShards> shards_;
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> evictions_;
+
+    Shard& shardFor(const std::string& username);
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <vector>
+
+// Fixed-size pool of worker threads fed by a bounded FIFO. Submitting to a
+// full queue fails immediately instead of blocking the caller.
+class WorkerPool {
+public:
+    using Job = std::function<void()>;
+
+    WorkerPool(size_t threadCount, size_t maxQueuedJobs);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void start();
+    void stop();
+
+    bool trySubmit(Job job);
+
+    size_t queueDepth() const;
+    size_t queueCapacity() const { return maxQueuedJobs_; }
+    size_t threadCount() const { return threadCount_; }
+    uint64_t rejectedCount() const { return rejected_; }
+
+private:
+    size_t threadCount_;
+    size_t maxQueuedJobs_;
+    bool running_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    std::vector<std::thread> threads_;
+    std::atomic<uint64_t> rejected_;
+
+    void run();
+};
@@ -0,0 +1,154 @@
+// Microbenchmark for request parsing: the string_view parser against the
+// old istringstream + unordered_map one. Counts heap allocations per
+// request and exits non-zero if the new path allocates at all.
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "command.hpp"
+
+namespace {
+std::atomic<size_t> gAllocations{0};
+}
+
+void* operator new(size_t size) {
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+const int kIterations = 1000000;
+
+// The parser as it was before the string_view rewrite, kept for comparison.
+bool legacyParse(const std::string& data, std::string& cmd,
+                 std::unordered_map<std::string, std::string>& params) {
+    std::istringstream iss(data);
+    iss >> cmd;
+
+    std::string pair;
+    while (iss >> pair) {
+        size_t eqPos = pair.find('=');
+        if (eqPos != std::string::npos) {
+            std::string key = pair.substr(0, eqPos);
+            std::string value = pair.substr(eqPos + 1);
+            if (key == "body") {
+                std::string rest;
+                std::getline(iss, rest);
+                if (!rest.empty() && rest.front() == ' ') {
+                    rest.erase(0, 1);
+                }
+                if (!rest.empty()) {
+                    value += " " + rest;
+                }
+            }
+            params[key] = value;
+        }
+    }
+    return true;
+}
+
+struct Result {
+    double nsPerOp;
+    double allocsPerOp;
+};
+
+template <typename Fn>
+Result run(const std::vector<std::string>& requests, Fn&& fn) {
+    size_t sink = 0;
+    const size_t allocsBefore = gAllocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; ++i) {
+        sink += fn(requests[static_cast<size_t>(i) % requests.size()]);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    const size_t allocs = gAllocations.load() - allocsBefore;
+    if (sink == 42) {
+        std::cout << "";
+    }
+    return Result{
+        std::chrono::duration<double, std::nano>(elapsed).count() / kIterations,
+        static_cast<double>(allocs) / kIterations};
+}
+
+void report(const char* name, const Result& r) {
+    std::cout << name << ": " << r.nsPerOp << " ns/op, " << r.allocsPerOp << " allocs/op" << std::endl;
+}
+
+std::string frameFor(Opcode op, std::initializer_list<std::pair<FieldId, std::string>> fields) {
+    FrameWriter writer(op);
+    for (const auto& f : fields) {
+        if (isIntegerField(static_cast<uint8_t>(f.first))) {
+            writer.addU32(f.first, static_cast<uint32_t>(std::stoul(f.second)));
+        } else {
+            writer.add(f.first, f.second);
+        }
+    }
+    // Strip the length prefix; the event loop hands over frame bodies.
+    return writer.finish().substr(kFrameHeaderSize);
+}
+}
+
+int main() {
+    const std::string session = "0123456789abcdef0123456789abcdef";
+    const std::vector<std::string> textRequests = {
+        "SEND sessionId=" + session + " to=bob body=Hello Bob, how are you today?",
+        "GET_MESSAGES sessionId=" + session + " contact=alice limit=50 offset=0",
+        "LOGIN username=alice password=password123",
+        "GET_CHATS sessionId=" + session,
+        "LOGOUT sessionId=" + session,
+    };
+    const std::vector<std::string> frameRequests = {
+        frameFor(Opcode::Send, {{FieldId::SessionId, session}, {FieldId::To, "bob"},
+                                {FieldId::Body, "Hello Bob, how are you today?"}}),
+        frameFor(Opcode::GetMessages, {{FieldId::SessionId, session}, {FieldId::Contact, "alice"},
+                                       {FieldId::Limit, "50"}, {FieldId::Offset, "0"}}),
+        frameFor(Opcode::Login, {{FieldId::Username, "alice"}, {FieldId::Password, "password123"}}),
+        frameFor(Opcode::GetChats, {{FieldId::SessionId, session}}),
+        frameFor(Opcode::Logout, {{FieldId::SessionId, session}}),
+    };
+
+    Result legacy = run(textRequests, [](const std::string& line) {
+        std::string cmd;
+        std::unordered_map<std::string, std::string> params;
+        legacyParse(line, cmd, params);
+        return params["sessionId"].size() + params["limit"].size();
+    });
+
+    Result text = run(textRequests, [](const std::string& line) {
+        Command cmd;
+        parseTextCommand(line, cmd);
+        return cmd.get(FieldId::SessionId).size() + static_cast<size_t>(cmd.getInt(FieldId::Limit, 50)) + cmd.opcode;
+    });
+
+    Result binary = run(frameRequests, [](const std::string& body) {
+        Command cmd;
+        parseFrameCommand(body, cmd);
+        return cmd.get(FieldId::SessionId).size() + static_cast<size_t>(cmd.getInt(FieldId::Limit, 50)) + cmd.opcode;
+    });
+
+    report("legacy text ", legacy);
+    report("text        ", text);
+    report("binary      ", binary);
+
+    if (text.allocsPerOp > 0 || binary.allocsPerOp > 0) {
+        std::cerr << "FAIL: parser allocated on the request path" << std::endl;
+        return 1;
+    }
+    return 0;
+}
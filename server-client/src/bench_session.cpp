@@ -0,0 +1,111 @@
+// Microbenchmark for session creation: the old id generator (a fresh
+// random_device and mt19937 per id, hex through a stringstream) against
+// SecureRandom, then whole createSession calls from several threads.
+// Exits non-zero if an id has the wrong shape or repeats.
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "secure_random.hpp"
+#include "session.hpp"
+
+namespace {
+const int kIds = 200000;
+const int kThreads = 4;
+const int kSessionsPerThread = 100000;
+
+// The generator as it was before SecureRandom, kept for comparison.
+std::string legacySessionId() {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> dis(0, 15);
+
+    std::stringstream ss;
+    for (int i = 0; i < 32; i++) {
+        ss << std::hex << dis(gen);
+    }
+    return ss.str();
+}
+
+template <typename Fn>
+double perSecond(int count, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return count / elapsed.count();
+}
+
+bool wellFormed(const std::string& id) {
+    if (id.size() != 32) {
+        return false;
+    }
+    for (char c : id) {
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+double createSessions(SessionManager& sessions) {
+    return perSecond(kThreads * kSessionsPerThread, [&sessions] {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t) {
+            threads.emplace_back([&sessions, t] {
+                for (int i = 0; i < kSessionsPerThread; ++i) {
+                    sessions.createSession(t * kSessionsPerThread + i, "bench_user");
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    });
+}
+}
+
+int main() {
+    size_t sink = 0;
+    const double legacy = perSecond(kIds, [&sink] {
+        for (int i = 0; i < kIds; ++i) {
+            sink += legacySessionId().size();
+        }
+    });
+
+    std::vector<std::string> ids;
+    ids.reserve(kIds);
+    const double secure = perSecond(kIds, [&ids] {
+        for (int i = 0; i < kIds; ++i) {
+            ids.push_back(SecureRandom::hex(16));
+        }
+    });
+
+    bool ok = sink == static_cast<size_t>(kIds) * 32;
+    std::unordered_set<std::string> seen;
+    for (const auto& id : ids) {
+        ok &= wellFormed(id) && seen.insert(id).second;
+    }
+
+    SessionManager table;
+    const double tableRate = createSessions(table);
+    SessionManager tokens(std::chrono::seconds(3600), "bench-secret");
+    const double tokenRate = createSessions(tokens);
+    ok &= table.stats().active == static_cast<size_t>(kThreads * kSessionsPerThread);
+
+    std::cout << std::fixed << std::setprecision(0)
+              << "legacy ids        : " << legacy << " ids/s" << std::endl
+              << "SecureRandom ids  : " << secure << " ids/s" << std::endl
+              << "createSession     : " << tableRate << " sessions/s (" << kThreads << " threads)" << std::endl
+              << "createSession tok : " << tokenRate << " sessions/s (" << kThreads << " threads)" << std::endl;
+
+    if (!ok) {
+        std::cerr << "FAIL: malformed or repeated session id" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,11 +1,12 @@
 #include "client.hpp"
+#include "protocol.hpp"
 #include <sstream>
 #include <cstring>
 #include <cerrno>
 #include <sys/time.h>
 
 MessengerClient::MessengerClient(const std::string& host, int port)
-    : host_(host), port_(port), socket_(-1), userId_(-1) {}
+    : host_(host), port_(port), socket_(-1), userId_(-1), binary_(false) {}
 
 MessengerClient::~MessengerClient() {
     disconnect();
@@ -57,6 +58,8 @@ void MessengerClient::disconnect() {
         socket_ = -1;
         sessionId_ = "";
         userId_ = -1;
+        binary_ = false;
+        recvBuffer_.clear();
         std::cout << "[Client] Disconnected" << std::endl;
     }
 }
@@ -65,21 +68,83 @@ bool MessengerClient::isConnected() const {
     return socket_ >= 0;
 }
 
+bool MessengerClient::enableBinaryProtocol() {
+    if (!isConnected()) {
+        return false;
+    }
+    if (binary_) {
+        return true;
+    }
+
+    if (!sendAll(std::string(kBinaryUpgradeRequest) + "\n")) {
+        std::cerr << "[Client] Failed to send command" << std::endl;
+        return false;
+    }
+
+    std::string response;
+    if (!readLine(response) || response != kBinaryUpgradeResponse) {
+        std::cerr << "[Client] Server refused binary protocol" << std::endl;
+        return false;
+    }
+
+    binary_ = true;
+    return true;
+}
+
 std::string MessengerClient::buildCommand(const std::string& cmd, 
                                           const std::unordered_map<std::string, std::string>& params) {
     std::string result = cmd;
     for (const auto& p : params) {
-        result += " " + p.first + "=" + p.second;
+        if (p.first != "body") {
+            result += " " + p.first + "=" + p.second;
+        }
+    }
+    // The server reads body up to the end of the line, so it has to go last.
+    auto body = params.find("body");
+    if (body != params.end()) {
+        result += " body=" + body->second;
     }
     return result;
 }
 
-std::string MessengerClient::sendCommand(const std::string& cmd) {
+std::string MessengerClient::buildFrame(const std::string& cmd,
+                                        const std::unordered_map<std::string, std::string>& params) {
+    uint8_t opcode = 0;
+    if (!commandOpcode(cmd, opcode)) {
+        return "";
+    }
+
+    FrameWriter frame(static_cast<Opcode>(opcode));
+    for (const auto& p : params) {
+        uint8_t fieldId = 0;
+        if (!fieldIdForName(p.first, fieldId)) {
+            continue;
+        }
+        if (isIntegerField(fieldId)) {
+            frame.addU32(static_cast<FieldId>(fieldId), static_cast<uint32_t>(std::stoul(p.second)));
+        } else {
+            frame.addRaw(fieldId, p.second.data(), p.second.size());
+        }
+    }
+    return frame.finish();
+}
+
+std::string MessengerClient::sendCommand(const std::string& cmd,
+                                         const std::unordered_map<std::string, std::string>& params) {
     if (!isConnected()) {
         return "[ERROR] Not connected";
     }
 
-    if (!sendAll(cmd + "\n")) {
+    if (binary_) {
+        std::string frame = buildFrame(cmd, params);
+        if (frame.empty()) {
+            return "[ERROR] Unknown command";
+        }
+        std::string body;
+        return sendFrame(frame, body);
+    }
+
+    if (!sendAll(buildCommand(cmd, params) + "\n")) {
         std::cerr << "[Client] Failed to send command" << std::endl;
         return "[ERROR] Send failed";
     }
@@ -93,6 +158,32 @@ std::string MessengerClient::sendCommand(const std::string& cmd) {
     return response;
 }
 
+// Sends one frame and waits for its Response frame, skipping any pushed
+// events. Returns the status text; body keeps the whole frame for callers
+// that want the other fields.
+std::string MessengerClient::sendFrame(const std::string& frame, std::string& body) {
+    if (!sendAll(frame)) {
+        std::cerr << "[Client] Failed to send command" << std::endl;
+        return "[ERROR] Send failed";
+    }
+
+    uint8_t opcode = 0;
+    std::vector<FrameField> fields;
+    do {
+        if (!readFrame(body) || !parseFrameBody(body, opcode, fields)) {
+            std::cerr << "[Client] Failed to receive response" << std::endl;
+            return "[ERROR] Receive failed";
+        }
+    } while (opcode != static_cast<uint8_t>(Opcode::Response));
+
+    for (const auto& field : fields) {
+        if (field.id == static_cast<uint8_t>(FieldId::Text)) {
+            return field.asString();
+        }
+    }
+    return "[ERROR] Malformed response";
+}
+
 bool MessengerClient::sendAll(const std::string& data) {
     size_t totalSent = 0;
     while (totalSent < data.size()) {
@@ -138,13 +229,38 @@ bool MessengerClient::readLine(std::string& line) {
     }
 }
 
+bool MessengerClient::readFrame(std::string& body) {
+    while (true) {
+        if (recvBuffer_.size() >= kFrameHeaderSize) {
+            const uint32_t length = readFrameLength(recvBuffer_.data());
+            if (length > kMaxFrameSize) {
+                return false;
+            }
+            if (recvBuffer_.size() - kFrameHeaderSize >= length) {
+                body = recvBuffer_.substr(kFrameHeaderSize, length);
+                recvBuffer_.erase(0, kFrameHeaderSize + length);
+                return true;
+            }
+        }
+
+        char chunk[4096];
+        int n = recv(socket_, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        recvBuffer_.append(chunk, static_cast<size_t>(n));
+    }
+}
+
 std::string MessengerClient::registerUser(const std::string& username, const std::string& password) {
     std::unordered_map<std::string, std::string> params = {
         {"username", username},
         {"password", password}
     };
-    std::string cmd = buildCommand("REGISTER", params);
-    std::string response = sendCommand(cmd);
+    std::string response = sendCommand("REGISTER", params);
 
     // Parse response: [OK] REGISTER:sessionId=...:userId=...
     if (response.find("[OK]") == 0) {
@@ -165,8 +281,7 @@ std::string MessengerClient::login(const std::string& username, const std::strin
         {"username", username},
         {"password", password}
     };
-    std::string cmd = buildCommand("LOGIN", params);
-    std::string response = sendCommand(cmd);
+    std::string response = sendCommand("LOGIN", params);
 
     // Parse response: [OK] LOGIN:sessionId=...:userId=...
     if (response.find("[OK]") == 0) {
@@ -186,8 +301,7 @@ std::string MessengerClient::logout() {
     std::unordered_map<std::string, std::string> params = {
         {"sessionId", sessionId_}
     };
-    std::string cmd = buildCommand("LOGOUT", params);
-    std::string response = sendCommand(cmd);
+    std::string response = sendCommand("LOGOUT", params);
     sessionId_ = "";
     userId_ = -1;
     return response;
@@ -199,17 +313,174 @@ std::string MessengerClient::sendMessage(const std::string& to, const std::strin
         {"to", to},
         {"body", body}
     };
-    return sendCommand(buildCommand("SEND", params));
+    return sendCommand("SEND", params);
 }
 
-std::string MessengerClient::getMessages(const std::string& contact, int limit, int offset) {
+std::unordered_map<std::string, std::string> MessengerClient::messageParams(
+    const std::string& contact, int limit, int offset, const MessageCursor& cursor) const {
     std::unordered_map<std::string, std::string> params = {
         {"sessionId", sessionId_},
         {"contact", contact},
-        {"limit", std::to_string(limit)},
-        {"offset", std::to_string(offset)}
+        {"limit", std::to_string(limit)}
     };
-    return sendCommand(buildCommand("GET_MESSAGES", params));
+    if (offset > 0) {
+        params["offset"] = std::to_string(offset);
+    }
+    if (cursor.beforeId > 0) {
+        params["before_id"] = std::to_string(cursor.beforeId);
+    }
+    if (cursor.afterId > 0) {
+        params["after_id"] = std::to_string(cursor.afterId);
+    }
+    return params;
+}
+
+std::string MessengerClient::getMessages(const std::string& contact, int limit, int offset) {
+    return sendCommand("GET_MESSAGES", messageParams(contact, limit, offset, MessageCursor()));
+}
+
+std::string MessengerClient::getMessages(const std::string& contact, const MessageCursor& cursor, int limit) {
+    return sendCommand("GET_MESSAGES", messageParams(contact, limit, 0, cursor));
+}
+
+namespace {
+std::string base64Decode(const std::string& in) {
+    std::string out;
+    int val = 0;
+    int bits = -8;
+    for (unsigned char c : in) {
+        int d;
+        if (c >= 'A' && c <= 'Z') d = c - 'A';
+        else if (c >= 'a' && c <= 'z') d = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') d = c - '0' + 52;
+        else if (c == '+') d = 62;
+        else if (c == '/') d = 63;
+        else break;
+        val = (val << 6) | d;
+        bits += 6;
+        if (bits >= 0) {
+            out.push_back(static_cast<char>((val >> bits) & 0xFF));
+            bits -= 8;
+        }
+    }
+    return out;
+}
+
+// Text rows look like id:sender:isRead:body:e2e:pub. The body may itself
+// contain ':', so the last two columns are taken from the right.
+bool parseMessageRow(const std::string& row, MessageRecord& record) {
+    size_t p1 = row.find(':');
+    size_t p2 = p1 == std::string::npos ? p1 : row.find(':', p1 + 1);
+    size_t p3 = p2 == std::string::npos ? p2 : row.find(':', p2 + 1);
+    size_t p5 = row.rfind(':');
+    size_t p4 = p5 == std::string::npos || p5 == 0 ? std::string::npos : row.rfind(':', p5 - 1);
+    if (p3 == std::string::npos || p4 == std::string::npos || p4 < p3) {
+        return false;
+    }
+    try {
+        record.id = std::stoi(row.substr(0, p1));
+        record.senderId = std::stoi(row.substr(p1 + 1, p2 - p1 - 1));
+    } catch (const std::exception&) {
+        return false;
+    }
+    record.isRead = row.compare(p2 + 1, p3 - p2 - 1, "1") == 0;
+    record.body = row.substr(p3 + 1, p4 - p3 - 1);
+    record.e2ePayload = base64Decode(row.substr(p4 + 1, p5 - p4 - 1));
+    record.e2ePub = row.substr(p5 + 1);
+    return true;
+}
+}
+
+std::string MessengerClient::getMessages(const std::string& contact, std::vector<MessageRecord>& records,
+                                         int limit, int offset) {
+    return fetchMessages(messageParams(contact, limit, offset, MessageCursor()), records);
+}
+
+std::string MessengerClient::getMessages(const std::string& contact, std::vector<MessageRecord>& records,
+                                         const MessageCursor& cursor, int limit) {
+    return fetchMessages(messageParams(contact, limit, 0, cursor), records);
+}
+
+std::string MessengerClient::fetchMessages(const std::unordered_map<std::string, std::string>& params,
+                                           std::vector<MessageRecord>& records) {
+    records.clear();
+
+    if (!binary_) {
+        std::string response = sendCommand("GET_MESSAGES", params);
+        if (response.find("[OK]") != 0) {
+            return response;
+        }
+        size_t pos = response.find('|');
+        while (pos != std::string::npos) {
+            size_t next = response.find('|', pos + 1);
+            MessageRecord record;
+            if (parseMessageRow(response.substr(pos + 1, next == std::string::npos ? std::string::npos : next - pos - 1), record)) {
+                records.push_back(std::move(record));
+            }
+            pos = next;
+        }
+        return response;
+    }
+
+    if (!isConnected()) {
+        return "[ERROR] Not connected";
+    }
+    // A page too large for one frame arrives in several: each cut-short
+    // frame ends with the afterId to ask for the rest with.
+    std::unordered_map<std::string, std::string> request = params;
+    const auto limitParam = params.find("limit");
+    const size_t limit = limitParam == params.end() ? 0 : static_cast<size_t>(std::stoi(limitParam->second));
+    while (true) {
+        std::string body;
+        std::string response = sendFrame(buildFrame("GET_MESSAGES", request), body);
+        if (response.find("[OK]") != 0) {
+            return response;
+        }
+
+        uint32_t resumeAfter = 0;
+        parseMessageFrame(body, records, resumeAfter);
+        if (resumeAfter == 0 || records.size() >= limit) {
+            return response;
+        }
+        request.erase("offset");
+        request.erase("before_id");
+        request["after_id"] = std::to_string(resumeAfter);
+        request["limit"] = std::to_string(limit - records.size());
+    }
+}
+
+void MessengerClient::parseMessageFrame(const std::string& body, std::vector<MessageRecord>& records,
+                                        uint32_t& resumeAfter) {
+    uint8_t opcode = 0;
+    std::vector<FrameField> fields;
+    parseFrameBody(body, opcode, fields);
+    for (const auto& field : fields) {
+        switch (static_cast<FieldId>(field.id)) {
+        case FieldId::MessageId:
+            records.push_back(MessageRecord{static_cast<int>(field.asU32()), 0, false, "", "", ""});
+            break;
+        case FieldId::SenderId:
+            if (!records.empty()) records.back().senderId = static_cast<int>(field.asU32());
+            break;
+        case FieldId::IsRead:
+            if (!records.empty()) records.back().isRead = field.size > 0 && field.data[0] != 0;
+            break;
+        case FieldId::Body:
+            if (!records.empty()) records.back().body = field.asString();
+            break;
+        case FieldId::E2e:
+            if (!records.empty()) records.back().e2ePayload = field.asString();
+            break;
+        case FieldId::E2ePub:
+            if (!records.empty()) records.back().e2ePub = field.asString();
+            break;
+        case FieldId::AfterId:
+            resumeAfter = field.asU32();
+            break;
+        default:
+            break;
+        }
+    }
 }
 
 std::string MessengerClient::getInbox(int limit, int offset) {
@@ -218,5 +489,44 @@ std::string MessengerClient::getInbox(int limit, int offset) {
         {"limit", std::to_string(limit)},
         {"offset", std::to_string(offset)}
     };
-    return sendCommand(buildCommand("GET_INBOX", params));
+    if (!binary_) {
+        return sendCommand("GET_INBOX", params);
+    }
+    if (!isConnected()) {
+        return "[ERROR] Not connected";
+    }
+
+    // As with messages, a cut-short frame carries the offset of the rest;
+    // their rows are appended to the first frame's line.
+    const int end = offset + limit;
+    std::string inbox;
+    while (true) {
+        std::string body;
+        std::string response = sendFrame(buildFrame("GET_INBOX", params), body);
+        if (response.find("[OK]") != 0) {
+            return inbox.empty() ? response : inbox;
+        }
+        const size_t rows = response.find('|');
+        if (inbox.empty()) {
+            inbox = response;
+        } else if (rows != std::string::npos) {
+            inbox += response.substr(rows);
+        }
+
+        uint8_t opcode = 0;
+        std::vector<FrameField> fields;
+        parseFrameBody(body, opcode, fields);
+        int resumeAt = 0;
+        for (const auto& field : fields) {
+            if (field.id == static_cast<uint8_t>(FieldId::Offset)) {
+                resumeAt = static_cast<int>(field.asU32());
+            }
+        }
+        if (resumeAt <= offset || resumeAt >= end) {
+            return inbox;
+        }
+        offset = resumeAt;
+        params["limit"] = std::to_string(end - offset);
+        params["offset"] = std::to_string(offset);
+    }
 }
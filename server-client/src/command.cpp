@@ -0,0 +1,113 @@
+#include "command.hpp"
+#include <charconv>
+#include <climits>
+
+namespace {
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+void skipSpaces(std::string_view text, size_t& pos) {
+    while (pos < text.size() && isSpace(text[pos])) {
+        ++pos;
+    }
+}
+
+std::string_view nextToken(std::string_view text, size_t& pos) {
+    skipSpaces(text, pos);
+    const size_t start = pos;
+    while (pos < text.size() && !isSpace(text[pos])) {
+        ++pos;
+    }
+    return text.substr(start, pos - start);
+}
+}
+
+int Command::getInt(FieldId id, int fallback) const {
+    std::string_view value = get(id);
+    if (value.empty()) {
+        return fallback;
+    }
+
+    if (format == WireFormat::Binary) {
+        if (value.size() != 4) {
+            return fallback;
+        }
+        const uint32_t raw = readFrameLength(value.data());
+        return raw > static_cast<uint32_t>(INT_MAX) ? INT_MAX : static_cast<int>(raw);
+    }
+
+    int parsed = 0;
+    auto result = std::from_chars(value.data(), value.data() + value.size(), parsed);
+    if (result.ptr == value.data() || result.ec != std::errc()) {
+        return fallback;
+    }
+    return parsed < 0 ? 0 : parsed;
+}
+
+void parseTextCommand(std::string_view line, Command& out) {
+    out = Command();
+    out.format = WireFormat::Text;
+
+    size_t pos = 0;
+    if (!commandOpcode(nextToken(line, pos), out.opcode)) {
+        out.opcode = 0;
+    }
+
+    while (pos < line.size()) {
+        skipSpaces(line, pos);
+        const size_t tokenStart = pos;
+        std::string_view pair = nextToken(line, pos);
+        const size_t eq = pair.find('=');
+        if (eq == std::string_view::npos) {
+            continue;
+        }
+
+        uint8_t fieldId = 0;
+        if (!fieldIdForName(pair.substr(0, eq), fieldId)) {
+            continue;
+        }
+
+        std::string_view value = pair.substr(eq + 1);
+        if (fieldId == static_cast<uint8_t>(FieldId::Body)) {
+            // The body runs to the end of the line, spaces included.
+            value = line.substr(tokenStart + eq + 1);
+            if (!value.empty() && value.back() == '\r') {
+                value.remove_suffix(1);
+            }
+            pos = line.size();
+        }
+        out.fields[fieldId] = value;
+    }
+}
+
+bool parseFrameCommand(std::string_view body, Command& out) {
+    out = Command();
+    out.format = WireFormat::Binary;
+    if (body.empty()) {
+        return false;
+    }
+
+    out.opcode = static_cast<uint8_t>(body[0]);
+    if (!commandName(out.opcode)) {
+        return false;
+    }
+
+    size_t pos = 1;
+    while (pos < body.size()) {
+        if (body.size() - pos < 5) {
+            return false;
+        }
+        const uint8_t fieldId = static_cast<uint8_t>(body[pos]);
+        const uint32_t size = readFrameLength(body.data() + pos + 1);
+        pos += 5;
+        if (size > body.size() - pos) {
+            return false;
+        }
+        if (fieldId < kRequestFieldSlots) {
+            out.fields[fieldId] = body.substr(pos, size);
+        }
+        pos += size;
+    }
+    return true;
+}
@@ -0,0 +1,288 @@
+#include "connection.hpp"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <iterator>
+
+namespace {
+// Upper bound on bytes pulled off the socket before the loop parses lines,
+// so one fast sender cannot grow its buffer without limit in a single edge.
+const size_t kReadBudget = 256 * 1024;
+// Free space guaranteed before each read, so one syscall moves a large chunk.
+const size_t kMinReadSize = 32 * 1024;
+// How many bytes of queued events are moved into the send queue at a time.
+const size_t kEventStageBytes = 64 * 1024;
+// Responses below this size are copied into the tail segment instead of
+// getting their own iovec, up to kPackedSegmentBytes per segment.
+const size_t kPackBelowBytes = 4 * 1024;
+const size_t kPackedSegmentBytes = 64 * 1024;
+
+#ifdef MSG_NOSIGNAL
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+}
+
+Connection::Connection(int fd, EventLoop* loop)
+    : fd_(fd), loop_(loop), inputFormat_(WireFormat::Text), frameTooLarge_(false),
+      scheduled_(false), inputEnded_(false), readPaused_(false), outOffset_(0), eventFormat_(WireFormat::Text), streaming_(false),
+      closed_(false), subscribed_(false) {}
+
+Connection::~Connection() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+Connection::ReadStatus Connection::readAvailable() {
+    size_t readThisCall = 0;
+    while (readThisCall < kReadBudget) {
+        ssize_t n = inBuffer_.readFrom(fd_, kMinReadSize);
+        if (n > 0) {
+            readThisCall += static_cast<size_t>(n);
+            continue;
+        }
+        if (n == 0) {
+            return ReadStatus::EndOfInput;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return ReadStatus::Drained;
+        }
+        return ReadStatus::Closed;
+    }
+    return ReadStatus::Partial;
+}
+
+bool Connection::nextRequest(InboundRequest& request) {
+    request.format = inputFormat_;
+    if (inputFormat_ == WireFormat::Binary) {
+        return inBuffer_.nextFrame(request.data, kMaxFrameSize, frameTooLarge_);
+    }
+
+    if (!inBuffer_.nextLine(request.data)) {
+        return false;
+    }
+    if (isBinaryUpgradeRequest(request.data)) {
+        inputFormat_ = WireFormat::Binary;
+    }
+    return true;
+}
+
+bool Connection::requestTooLarge() const {
+    if (inputFormat_ == WireFormat::Binary) {
+        return frameTooLarge_;
+    }
+    return inBuffer_.partialLineLength() > kMaxMessageSize;
+}
+
+bool Connection::enqueueRequest(InboundRequest&& request) {
+    std::lock_guard<std::mutex> lock(requestsMutex_);
+    pendingRequests_.push_back(std::move(request));
+    if (pendingRequests_.size() >= kMaxPendingRequests) {
+        readPaused_ = true;
+    }
+    if (scheduled_) {
+        return false;
+    }
+    scheduled_ = true;
+    return true;
+}
+
+bool Connection::takeRequests(std::vector<InboundRequest>& out, bool& resumeReading) {
+    std::lock_guard<std::mutex> lock(requestsMutex_);
+    out.clear();
+    resumeReading = false;
+    if (pendingRequests_.empty() || closed_) {
+        pendingRequests_.clear();
+        scheduled_ = false;
+        return false;
+    }
+    out.assign(std::make_move_iterator(pendingRequests_.begin()),
+               std::make_move_iterator(pendingRequests_.end()));
+    pendingRequests_.clear();
+    if (readPaused_) {
+        readPaused_ = false;
+        resumeReading = true;
+    }
+    return true;
+}
+
+void Connection::endInput() {
+    std::lock_guard<std::mutex> lock(requestsMutex_);
+    inputEnded_ = true;
+}
+
+// Under requestsMutex_, so exactly one of the loop (seeing EOF) and the
+// worker (finding the queue empty) sees the last request answered.
+bool Connection::inputDone() {
+    std::lock_guard<std::mutex> lock(requestsMutex_);
+    return inputEnded_ && !scheduled_;
+}
+
+void Connection::cancelScheduling(std::vector<InboundRequest>& dropped) {
+    std::lock_guard<std::mutex> lock(requestsMutex_);
+    dropped.assign(std::make_move_iterator(pendingRequests_.begin()),
+                   std::make_move_iterator(pendingRequests_.end()));
+    pendingRequests_.clear();
+    scheduled_ = false;
+    readPaused_ = false;
+}
+
+void Connection::queueResponse(std::string response) {
+    makeLineSafe(response);
+    response += '\n';
+    queueFrame(std::move(response));
+}
+
+void Connection::queueFrame(std::string frame) {
+    std::lock_guard<std::mutex> lock(outMutex_);
+    appendOutputLocked(std::move(frame));
+}
+
+void Connection::upgradeEvents(std::string ack) {
+    makeLineSafe(ack);
+    ack += '\n';
+    std::lock_guard<std::mutex> lock(outMutex_);
+    appendOutputLocked(std::move(ack));
+    eventFormat_ = WireFormat::Binary;
+}
+
+void Connection::appendOutputLocked(std::string bytes) {
+    if (bytes.size() < kPackBelowBytes && !out_.empty() && !out_.back().shared &&
+        out_.back().owned.size() + bytes.size() <= kPackedSegmentBytes) {
+        out_.back().owned += bytes;
+        return;
+    }
+    out_.push_back(OutSegment{std::move(bytes), nullptr});
+}
+
+Connection::EventStatus Connection::queueEvent(const std::shared_ptr<const std::string>& payload,
+                                               size_t maxQueued, SlowConsumerPolicy policy) {
+    std::lock_guard<std::mutex> lock(outMutex_);
+    EventStatus status = EventStatus::Queued;
+    if (events_.size() >= maxQueued) {
+        if (policy == SlowConsumerPolicy::Disconnect) {
+            return EventStatus::Overflow;
+        }
+        events_.pop_front();
+        status = EventStatus::DroppedOldest;
+    }
+    events_.push_back(payload);
+    return status;
+}
+
+bool Connection::flush() {
+    std::lock_guard<std::mutex> lock(outMutex_);
+    if (closed_) {
+        return false;
+    }
+
+    while (true) {
+        if (out_.empty()) {
+            if (streaming_) {
+                return true;
+            }
+            size_t staged = 0;
+            while (!events_.empty() && staged < kEventStageBytes) {
+                if (eventFormat_ == WireFormat::Binary) {
+                    out_.push_back(OutSegment{
+                        FrameWriter(Opcode::Event).add(FieldId::Text, *events_.front()).finish(), nullptr});
+                } else if (breaksLine(*events_.front())) {
+                    std::string line;
+                    appendLineSafe(line, *events_.front());
+                    line += '\n';
+                    out_.push_back(OutSegment{std::move(line), nullptr});
+                } else {
+                    // The payload is shared with the other subscribers; only
+                    // the separator is ours.
+                    out_.push_back(OutSegment{std::string(), events_.front()});
+                    out_.push_back(OutSegment{std::string(1, '\n'), nullptr});
+                }
+                staged += events_.front()->size();
+                events_.pop_front();
+            }
+            if (out_.empty()) {
+                return true;
+            }
+            outOffset_ = 0;
+        }
+
+        iovec iov[kMaxIovecs];
+        size_t count = 0;
+        for (auto it = out_.begin(); it != out_.end() && count < kMaxIovecs; ++it, ++count) {
+            const size_t skip = count == 0 ? outOffset_ : 0;
+            iov[count].iov_base = const_cast<char*>(it->data() + skip);
+            iov[count].iov_len = it->size() - skip;
+        }
+
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        int flags = kSendFlags;
+#ifdef MSG_MORE
+        // More segments follow right away; let the kernel fill whole packets.
+        if (count < out_.size() || !events_.empty()) {
+            flags |= MSG_MORE;
+        }
+#endif
+        ssize_t sent = sendmsg(fd_, &msg, flags);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // The loop gets an EPOLLOUT edge once the socket drains.
+                return true;
+            }
+            return false;
+        }
+
+        size_t remaining = static_cast<size_t>(sent);
+        while (remaining > 0) {
+            const size_t left = out_.front().size() - outOffset_;
+            if (remaining < left) {
+                outOffset_ += remaining;
+                break;
+            }
+            remaining -= left;
+            out_.pop_front();
+            outOffset_ = 0;
+        }
+    }
+}
+
+bool Connection::hasPendingOutput() {
+    std::lock_guard<std::mutex> lock(outMutex_);
+    return !out_.empty() || !events_.empty();
+}
+
+size_t Connection::pendingOutputBytes() {
+    std::lock_guard<std::mutex> lock(outMutex_);
+    size_t bytes = 0;
+    for (const auto& segment : out_) {
+        bytes += segment.size();
+    }
+    return bytes - outOffset_;
+}
+
+void Connection::beginStreamedResponse() {
+    std::lock_guard<std::mutex> lock(outMutex_);
+    streaming_ = true;
+}
+
+void Connection::endStreamedResponse() {
+    std::lock_guard<std::mutex> lock(outMutex_);
+    streaming_ = false;
+}
+
+void Connection::markClosed() {
+    std::lock_guard<std::mutex> lock(outMutex_);
+    if (closed_) return;
+    closed_ = true;
+    shutdown(fd_, SHUT_RDWR);
+}
@@ -0,0 +1,350 @@
+#include "event_loop.hpp"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+const int kMaxEvents = 256;
+
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return false;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+}
+
+EventLoop::EventLoop(RequestHandler onRequest, CloseHandler onClose)
+    : epollFd_(-1), wakeFd_(-1), listenFd_(-1), running_(false),
+      onRequest_(std::move(onRequest)), onClose_(std::move(onClose)) {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ < 0) {
+        throw std::runtime_error("[Server.EventLoop] epoll_create1 failed");
+    }
+
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd_ < 0) {
+        close(epollFd_);
+        throw std::runtime_error("[Server.EventLoop] eventfd failed");
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeFd_;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev) < 0) {
+        close(wakeFd_);
+        close(epollFd_);
+        throw std::runtime_error("[Server.EventLoop] Failed to register wake fd");
+    }
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    if (listenFd_ >= 0) {
+        close(listenFd_);
+    }
+    close(wakeFd_);
+    close(epollFd_);
+}
+
+void EventLoop::start() {
+    if (running_) return;
+    running_ = true;
+    thread_ = std::thread(&EventLoop::run, this);
+}
+
+void EventLoop::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+
+    wake();
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    if (listenFd_ >= 0) {
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, listenFd_, nullptr);
+        close(listenFd_);
+        listenFd_ = -1;
+    }
+
+    std::unordered_map<int, std::shared_ptr<Connection>> remaining;
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        remaining.swap(connections_);
+    }
+    for (auto& entry : remaining) {
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, entry.first, nullptr);
+        onClose_(entry.second);
+        entry.second->markClosed();
+    }
+}
+
+bool EventLoop::addConnection(int fd) {
+    if (!setNonBlocking(fd)) {
+        std::cerr << "[Server.EventLoop] Failed to make socket non-blocking" << std::endl;
+        close(fd);
+        return false;
+    }
+
+    // Responses are already batched per flush; Nagle would only hold the
+    // tail of a batch back waiting for the client's ACK.
+    int noDelay = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) < 0) {
+        std::cerr << "[Server.EventLoop] Failed to set TCP_NODELAY" << std::endl;
+    }
+
+    auto conn = std::make_shared<Connection>(fd, this);
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        connections_[fd] = conn;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        std::cerr << "[Server.EventLoop] Failed to register client socket" << std::endl;
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        connections_.erase(fd);
+        return false;
+    }
+    return true;
+}
+
+bool EventLoop::addListener(int fd) {
+    if (!setNonBlocking(fd)) {
+        std::cerr << "[Server.EventLoop] Failed to make listener non-blocking" << std::endl;
+        return false;
+    }
+
+    // Level-triggered: a backlog left over after one pass is picked up on
+    // the next epoll_wait instead of waiting for another connection.
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        std::cerr << "[Server.EventLoop] Failed to register listener" << std::endl;
+        return false;
+    }
+    listenFd_ = fd;
+    return true;
+}
+
+bool EventLoop::pinToCpu(int cpu) {
+    if (!thread_.joinable()) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread_.native_handle(), sizeof(set), &set) == 0;
+}
+
+size_t EventLoop::connectionCount() const {
+    std::lock_guard<std::mutex> lock(connectionsMutex_);
+    return connections_.size();
+}
+
+void EventLoop::resumeReading(const std::shared_ptr<Connection>& conn) {
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        resumeQueue_.push_back(conn);
+    }
+    wake();
+}
+
+void EventLoop::requestFlush(const std::shared_ptr<Connection>& conn) {
+    bool first;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        first = flushQueue_.empty() && resumeQueue_.empty();
+        flushQueue_.push_back(conn);
+    }
+    // One eventfd write is enough to cover everything queued before the loop
+    // wakes up and swaps the queues out.
+    if (first) {
+        wake();
+    }
+}
+
+void EventLoop::wake() {
+    uint64_t one = 1;
+    ssize_t ignored = write(wakeFd_, &one, sizeof(one));
+    (void)ignored;
+}
+
+void EventLoop::drainPending() {
+    std::vector<std::shared_ptr<Connection>> resume;
+    std::vector<std::shared_ptr<Connection>> flush;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        resume.swap(resumeQueue_);
+        flush.swap(flushQueue_);
+    }
+    for (auto& conn : resume) {
+        if (!conn->isClosed()) {
+            handleReadable(conn);
+        }
+    }
+    for (auto& conn : flush) {
+        if (!conn->isClosed()) {
+            flushOrClose(conn);
+        }
+    }
+}
+
+void EventLoop::acceptPending() {
+    // Bounded so a connection storm cannot starve the sockets already here.
+    for (int i = 0; i < kMaxEvents; ++i) {
+        sockaddr_in addr{};
+        socklen_t addrLen = sizeof(addr);
+        int fd = accept4(listenFd_, reinterpret_cast<sockaddr*>(&addr), &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "[Server.EventLoop] accept() failed" << std::endl;
+            }
+            return;
+        }
+
+        // inet_ntoa's static buffer is not safe with several shards logging.
+        char host[INET_ADDRSTRLEN] = "?";
+        inet_ntop(AF_INET, &addr.sin_addr, host, sizeof(host));
+        std::cout << "[Server] New client connection from "
+                  << host << ":" << ntohs(addr.sin_port) << std::endl;
+        addConnection(fd);
+    }
+}
+
+void EventLoop::run() {
+    std::vector<epoll_event> events(kMaxEvents);
+
+    while (running_) {
+        int n = epoll_wait(epollFd_, events.data(), kMaxEvents, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "[Server.EventLoop] epoll_wait failed" << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            const int fd = events[i].data.fd;
+            const uint32_t mask = events[i].events;
+
+            if (fd == wakeFd_) {
+                uint64_t value;
+                while (read(wakeFd_, &value, sizeof(value)) > 0) {}
+                drainPending();
+                continue;
+            }
+            if (fd == listenFd_) {
+                acceptPending();
+                continue;
+            }
+
+            std::shared_ptr<Connection> conn = findConnection(fd);
+            if (!conn) {
+                continue;
+            }
+
+            if (mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                handleReadable(conn);
+            }
+            if (!conn->isClosed() && (mask & EPOLLOUT)) {
+                flushOrClose(conn);
+            }
+        }
+    }
+}
+
+void EventLoop::handleReadable(const std::shared_ptr<Connection>& conn) {
+    Connection::ReadStatus status = Connection::ReadStatus::Drained;
+    try {
+        do {
+            // Requests left in the buffer are parsed when the worker resumes us.
+            if (conn->isReadPaused()) {
+                break;
+            }
+            status = conn->readAvailable();
+
+            InboundRequest request;
+            while (!conn->isReadPaused() && conn->nextRequest(request)) {
+                onRequest_(conn, std::move(request));
+            }
+            if (!conn->isReadPaused() && conn->requestTooLarge()) {
+                std::cerr << "[Server.EventLoop] Request exceeds maximum size, closing" << std::endl;
+                status = Connection::ReadStatus::Closed;
+            }
+        } while (status == Connection::ReadStatus::Partial);
+
+        // Nothing more can arrive after a hang-up, so the rest of the buffer
+        // is queued even past the pause limit.
+        if (status == Connection::ReadStatus::EndOfInput) {
+            InboundRequest request;
+            while (conn->nextRequest(request)) {
+                onRequest_(conn, std::move(request));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[Server] Client error: " << e.what() << std::endl;
+        status = Connection::ReadStatus::Closed;
+    }
+
+    if (status == Connection::ReadStatus::Closed) {
+        closeConnection(conn);
+        return;
+    }
+    // Answer everything that was parsed before a hang-up, then close; the
+    // workers may still be running those requests.
+    if (status == Connection::ReadStatus::EndOfInput) {
+        conn->endInput();
+    }
+    flushOrClose(conn);
+}
+
+void EventLoop::flushOrClose(const std::shared_ptr<Connection>& conn) {
+    if (!conn->flush() || (conn->inputDone() && !conn->hasPendingOutput())) {
+        closeConnection(conn);
+    }
+}
+
+void EventLoop::closeConnection(const std::shared_ptr<Connection>& conn) {
+    {
+        std::lock_guard<std::mutex> lock(connectionsMutex_);
+        if (connections_.erase(conn->fd()) == 0) {
+            return;
+        }
+    }
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, conn->fd(), nullptr);
+    onClose_(conn);
+    conn->markClosed();
+}
+
+std::shared_ptr<Connection> EventLoop::findConnection(int fd) {
+    std::lock_guard<std::mutex> lock(connectionsMutex_);
+    auto it = connections_.find(fd);
+    if (it == connections_.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
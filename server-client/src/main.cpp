@@ -54,7 +54,7 @@ bool daemonize(const std::string& logPath) {
 
 int main(int argc, char** argv) {
     std::string dbConnStr = "host=localhost port=5432 dbname=mes_db user=shirkinson password=mirkill200853";
-    int port = 5555;
+    ServerConfig config;
     bool runAsDaemon = false;
     std::string logPath;
     std::vector<std::string> positional;
@@ -70,7 +70,61 @@ int main(int argc, char** argv) {
         } else if (arg.rfind("--db=", 0) == 0) {
             dbConnStr = arg.substr(5);
         } else if (arg.rfind("--port=", 0) == 0) {
-            port = std::atoi(arg.substr(7).c_str());
+            config.port = std::atoi(arg.substr(7).c_str());
+        } else if (arg.rfind("--io-threads=", 0) == 0) {
+            config.ioThreads = std::atoi(arg.substr(13).c_str());
+        } else if (arg.rfind("--backlog=", 0) == 0) {
+            config.listenBacklog = std::atoi(arg.substr(10).c_str());
+        } else if (arg.rfind("--workers=", 0) == 0) {
+            config.workerThreads = std::atoi(arg.substr(10).c_str());
+        } else if (arg.rfind("--queue-size=", 0) == 0) {
+            config.maxQueuedJobs = std::atoi(arg.substr(13).c_str());
+        } else if (arg.rfind("--db-replica=", 0) == 0) {
+            config.dbReplicas.push_back(arg.substr(13));
+        } else if (arg.rfind("--replica-max-lag-kb=", 0) == 0) {
+            config.replicaMaxLagKb = std::atoi(arg.substr(21).c_str());
+        } else if (arg.rfind("--db-pool=", 0) == 0) {
+            config.dbPoolSize = std::atoi(arg.substr(10).c_str());
+        } else if (arg.rfind("--event-queue=", 0) == 0) {
+            config.maxQueuedEvents = std::atoi(arg.substr(14).c_str());
+        } else if (arg.rfind("--send-batch=", 0) == 0) {
+            config.sendBatchSize = std::atoi(arg.substr(13).c_str());
+        } else if (arg.rfind("--send-batch-delay-us=", 0) == 0) {
+            config.sendBatchDelayUs = std::atoi(arg.substr(22).c_str());
+        } else if (arg.rfind("--read-receipt-delay-ms=", 0) == 0) {
+            config.readReceiptDelayMs = std::atoi(arg.substr(24).c_str());
+        } else if (arg.rfind("--retention-days=", 0) == 0) {
+            config.messageRetentionDays = std::atoi(arg.substr(17).c_str());
+        } else if (arg.rfind("--partitions-ahead=", 0) == 0) {
+            config.partitionMonthsAhead = std::atoi(arg.substr(19).c_str());
+        } else if (arg.rfind("--user-cache=", 0) == 0) {
+            config.userCacheSize = std::atoi(arg.substr(13).c_str());
+        } else if (arg.rfind("--session-ttl=", 0) == 0) {
+            config.sessionTtlSeconds = std::atoi(arg.substr(14).c_str());
+        } else if (arg.rfind("--session-secret=", 0) == 0) {
+            config.sessionSecret = arg.substr(17);
+        } else if (arg.rfind("--shards=", 0) == 0) {
+            config.acceptShards = std::atoi(arg.substr(9).c_str());
+        } else if (arg == "--pin-cpus") {
+            config.pinCpus = true;
+        } else if (arg.rfind("--cpus=", 0) == 0) {
+            // Comma-separated CPU list; implies --pin-cpus.
+            std::string list = arg.substr(7);
+            size_t start = 0;
+            while (start <= list.size()) {
+                size_t comma = list.find(',', start);
+                std::string item = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+                if (!item.empty()) {
+                    config.cpus.push_back(std::atoi(item.c_str()));
+                }
+                if (comma == std::string::npos) break;
+                start = comma + 1;
+            }
+            config.pinCpus = !config.cpus.empty();
+        } else if (arg == "--slow-consumer=drop-oldest") {
+            config.slowConsumerPolicy = SlowConsumerPolicy::DropOldest;
+        } else if (arg == "--slow-consumer=disconnect") {
+            config.slowConsumerPolicy = SlowConsumerPolicy::Disconnect;
         } else if (!arg.empty() && arg[0] == '-') {
             std::cerr << "[Main] Unknown option: " << arg << std::endl;
             return 1;
@@ -79,11 +133,18 @@ int main(int argc, char** argv) {
         }
     }
 
+    // Preferred over --session-secret=, which other users can see in ps.
+    if (config.sessionSecret.empty()) {
+        const char* secret = std::getenv("MESSENGER_SESSION_SECRET");
+        if (secret) {
+            config.sessionSecret = secret;
+        }
+    }
     if (!positional.empty()) {
         dbConnStr = positional[0];
     }
     if (positional.size() > 1) {
-        port = std::atoi(positional[1].c_str());
+        config.port = std::atoi(positional[1].c_str());
     }
 
     if (runAsDaemon && logPath.empty()) {
@@ -103,7 +164,7 @@ int main(int argc, char** argv) {
             }
         }
 
-        gServer = new MessengerServer(dbConnStr, port);
+        gServer = new MessengerServer(dbConnStr, config);
         
         std::signal(SIGINT, signalHandler);
         std::signal(SIGTERM, signalHandler);
@@ -0,0 +1,237 @@
+#include "protocol.hpp"
+#include <array>
+#include <cstring>
+
+const char* const kBinaryUpgradeRequest = "PROTO mode=binary";
+const char* const kBinaryUpgradeResponse = "[OK] PROTO:binary";
+
+namespace {
+struct NameEntry {
+    std::string_view name;
+    uint8_t id;
+};
+
+// Both tables are sorted by name so text lookups can binary-search them.
+constexpr NameEntry kCommands[] = {
+    {"DELETE_CHAT", static_cast<uint8_t>(Opcode::DeleteChat)},
+    {"GET_AVATAR", static_cast<uint8_t>(Opcode::GetAvatar)},
+    {"GET_CHATS", static_cast<uint8_t>(Opcode::GetChats)},
+    {"GET_INBOX", static_cast<uint8_t>(Opcode::GetInbox)},
+    {"GET_MESSAGES", static_cast<uint8_t>(Opcode::GetMessages)},
+    {"GET_MESSAGES_E2E", static_cast<uint8_t>(Opcode::GetMessagesE2e)},
+    {"GET_PROFILE", static_cast<uint8_t>(Opcode::GetProfile)},
+    {"LOGIN", static_cast<uint8_t>(Opcode::Login)},
+    {"LOGOUT", static_cast<uint8_t>(Opcode::Logout)},
+    {"PROTO", static_cast<uint8_t>(Opcode::Proto)},
+    {"REGISTER", static_cast<uint8_t>(Opcode::Register)},
+    {"SEND", static_cast<uint8_t>(Opcode::Send)},
+    {"SEND_E2E", static_cast<uint8_t>(Opcode::SendE2e)},
+    {"SET_AVATAR", static_cast<uint8_t>(Opcode::SetAvatar)},
+    {"SET_E2E_PUB", static_cast<uint8_t>(Opcode::SetE2ePub)},
+    {"STATS", static_cast<uint8_t>(Opcode::Stats)},
+    {"SUBSCRIBE", static_cast<uint8_t>(Opcode::Subscribe)},
+};
+
+constexpr NameEntry kFields[] = {
+    {"after_id", static_cast<uint8_t>(FieldId::AfterId)},
+    {"before_id", static_cast<uint8_t>(FieldId::BeforeId)},
+    {"body", static_cast<uint8_t>(FieldId::Body)},
+    {"contact", static_cast<uint8_t>(FieldId::Contact)},
+    {"data", static_cast<uint8_t>(FieldId::Data)},
+    {"e2e", static_cast<uint8_t>(FieldId::E2e)},
+    {"e2e_pub", static_cast<uint8_t>(FieldId::E2ePub)},
+    {"hash", static_cast<uint8_t>(FieldId::Hash)},
+    {"limit", static_cast<uint8_t>(FieldId::Limit)},
+    {"mime", static_cast<uint8_t>(FieldId::Mime)},
+    {"offset", static_cast<uint8_t>(FieldId::Offset)},
+    {"order", static_cast<uint8_t>(FieldId::Order)},
+    {"password", static_cast<uint8_t>(FieldId::Password)},
+    {"pub", static_cast<uint8_t>(FieldId::Pub)},
+    {"sessionId", static_cast<uint8_t>(FieldId::SessionId)},
+    {"to", static_cast<uint8_t>(FieldId::To)},
+    {"username", static_cast<uint8_t>(FieldId::Username)},
+};
+
+template <size_t N>
+constexpr bool sortedByName(const NameEntry (&table)[N]) {
+    for (size_t i = 1; i < N; ++i) {
+        if (!(table[i - 1].name < table[i].name)) return false;
+    }
+    return true;
+}
+static_assert(sortedByName(kCommands), "kCommands must be sorted by name");
+static_assert(sortedByName(kFields), "kFields must be sorted by name");
+
+// Reverse index, so id -> name is a single array load.
+template <size_t N>
+constexpr std::array<const char*, 256> indexById(const NameEntry (&table)[N]) {
+    std::array<const char*, 256> index{};
+    for (size_t i = 0; i < N; ++i) {
+        index[table[i].id] = table[i].name.data();
+    }
+    return index;
+}
+constexpr auto kCommandNames = indexById(kCommands);
+constexpr auto kFieldNames = indexById(kFields);
+
+template <size_t N>
+bool findByName(const NameEntry (&table)[N], std::string_view name, uint8_t& id) {
+    size_t lo = 0;
+    size_t hi = N;
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (table[mid].name < name) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == N || table[lo].name != name) {
+        return false;
+    }
+    id = table[lo].id;
+    return true;
+}
+
+void appendU32(std::string& out, uint32_t value) {
+    out.push_back(static_cast<char>((value >> 24) & 0xFF));
+    out.push_back(static_cast<char>((value >> 16) & 0xFF));
+    out.push_back(static_cast<char>((value >> 8) & 0xFF));
+    out.push_back(static_cast<char>(value & 0xFF));
+}
+}
+
+bool isBinaryUpgradeRequest(std::string_view line) {
+    const size_t len = std::strlen(kBinaryUpgradeRequest);
+    if (line.substr(0, len) != kBinaryUpgradeRequest) {
+        return false;
+    }
+    return line.size() == len || (line.size() == len + 1 && line[len] == '\r');
+}
+
+bool breaksLine(std::string_view text) {
+    return text.find_first_of("\r\n") != std::string_view::npos;
+}
+
+void appendLineSafe(std::string& out, std::string_view text) {
+    const size_t start = out.size();
+    out += text;
+    for (size_t i = start; i < out.size(); ++i) {
+        if (out[i] == '\n' || out[i] == '\r') {
+            out[i] = ' ';
+        }
+    }
+}
+
+void makeLineSafe(std::string& line) {
+    for (char& c : line) {
+        if (c == '\n' || c == '\r') {
+            c = ' ';
+        }
+    }
+}
+
+const char* commandName(uint8_t opcode) {
+    return kCommandNames[opcode];
+}
+
+bool commandOpcode(std::string_view name, uint8_t& opcode) {
+    return findByName(kCommands, name, opcode);
+}
+
+const char* fieldName(uint8_t fieldId) {
+    return kFieldNames[fieldId];
+}
+
+bool fieldIdForName(std::string_view name, uint8_t& fieldId) {
+    return findByName(kFields, name, fieldId);
+}
+
+bool isIntegerField(uint8_t fieldId) {
+    switch (static_cast<FieldId>(fieldId)) {
+    case FieldId::Limit:
+    case FieldId::Offset:
+    case FieldId::BeforeId:
+    case FieldId::AfterId:
+    case FieldId::MessageId:
+    case FieldId::SenderId:
+        return true;
+    default:
+        return false;
+    }
+}
+
+uint32_t FrameField::asU32() const {
+    if (size != 4) {
+        return 0;
+    }
+    return readFrameLength(data);
+}
+
+FrameWriter::FrameWriter(Opcode opcode) {
+    buffer_.assign(kFrameHeaderSize, '\0');
+    buffer_.push_back(static_cast<char>(opcode));
+}
+
+FrameWriter& FrameWriter::add(FieldId field, const std::string& value) {
+    return addRaw(static_cast<uint8_t>(field), value.data(), value.size());
+}
+
+FrameWriter& FrameWriter::add(FieldId field, const char* data, size_t size) {
+    return addRaw(static_cast<uint8_t>(field), data, size);
+}
+
+FrameWriter& FrameWriter::addU32(FieldId field, uint32_t value) {
+    buffer_.push_back(static_cast<char>(field));
+    appendU32(buffer_, 4);
+    appendU32(buffer_, value);
+    return *this;
+}
+
+FrameWriter& FrameWriter::addRaw(uint8_t field, const char* data, size_t size) {
+    buffer_.push_back(static_cast<char>(field));
+    appendU32(buffer_, static_cast<uint32_t>(size));
+    buffer_.append(data, size);
+    return *this;
+}
+
+std::string FrameWriter::finish() {
+    const uint32_t length = static_cast<uint32_t>(buffer_.size() - kFrameHeaderSize);
+    buffer_[0] = static_cast<char>((length >> 24) & 0xFF);
+    buffer_[1] = static_cast<char>((length >> 16) & 0xFF);
+    buffer_[2] = static_cast<char>((length >> 8) & 0xFF);
+    buffer_[3] = static_cast<char>(length & 0xFF);
+    return std::move(buffer_);
+}
+
+uint32_t readFrameLength(const char* data) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+bool parseFrameBody(const std::string& body, uint8_t& opcode, std::vector<FrameField>& fields) {
+    fields.clear();
+    if (body.empty()) {
+        return false;
+    }
+    opcode = static_cast<uint8_t>(body[0]);
+
+    size_t pos = 1;
+    while (pos < body.size()) {
+        if (body.size() - pos < 5) {
+            return false;
+        }
+        FrameField field;
+        field.id = static_cast<uint8_t>(body[pos]);
+        field.size = readFrameLength(body.data() + pos + 1);
+        pos += 5;
+        if (field.size > body.size() - pos) {
+            return false;
+        }
+        field.data = body.data() + pos;
+        pos += field.size;
+        fields.push_back(field);
+    }
+    return true;
+}
@@ -0,0 +1,120 @@
+#include "recv_buffer.hpp"
+#include <sys/uio.h>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+}
+
+RecvBuffer::RecvBuffer(size_t initialCapacity)
+    : buffer_(roundUpToPowerOfTwo(initialCapacity)),
+      initialCapacity_(buffer_.size()), head_(0), tail_(0), scanned_(0) {}
+
+ssize_t RecvBuffer::readFrom(int fd, size_t minRead) {
+    if (head_ == tail_) {
+        // Restart at offset zero so the next read is one contiguous segment,
+        // and give back memory a single huge request made us allocate.
+        head_ = tail_ = scanned_ = 0;
+        if (buffer_.size() > initialCapacity_ * 4) {
+            std::vector<char>(initialCapacity_).swap(buffer_);
+        }
+    }
+
+    if (buffer_.size() - size() < minRead) {
+        grow(minRead);
+    }
+
+    const size_t cap = buffer_.size();
+    const size_t free = cap - size();
+    const size_t tailIdx = static_cast<size_t>(tail_) & mask();
+    const size_t first = std::min(free, cap - tailIdx);
+
+    iovec iov[2];
+    iov[0].iov_base = buffer_.data() + tailIdx;
+    iov[0].iov_len = first;
+    iov[1].iov_base = buffer_.data();
+    iov[1].iov_len = free - first;
+
+    ssize_t n = readv(fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+    if (n > 0) {
+        tail_ += static_cast<uint64_t>(n);
+    }
+    return n;
+}
+
+bool RecvBuffer::nextLine(std::string& line) {
+    const size_t cap = buffer_.size();
+    while (scanned_ < tail_) {
+        const size_t idx = static_cast<size_t>(scanned_) & mask();
+        const size_t span = std::min(static_cast<size_t>(tail_ - scanned_), cap - idx);
+        const void* hit = std::memchr(buffer_.data() + idx, '\n', span);
+        if (!hit) {
+            scanned_ += span;
+            continue;
+        }
+
+        const uint64_t newlinePos = scanned_ + static_cast<uint64_t>(static_cast<const char*>(hit) - (buffer_.data() + idx));
+        copyOut(head_, static_cast<size_t>(newlinePos - head_), line);
+        head_ = newlinePos + 1;
+        scanned_ = head_;
+        return true;
+    }
+    return false;
+}
+
+bool RecvBuffer::nextFrame(std::string& body, size_t maxFrame, bool& tooLarge) {
+    tooLarge = false;
+    if (size() < 4) {
+        return false;
+    }
+
+    uint32_t length = 0;
+    for (uint64_t i = 0; i < 4; ++i) {
+        length = (length << 8) | static_cast<unsigned char>(buffer_[static_cast<size_t>(head_ + i) & mask()]);
+    }
+    if (length > maxFrame) {
+        tooLarge = true;
+        return false;
+    }
+    if (size() < 4 + static_cast<size_t>(length)) {
+        return false;
+    }
+
+    copyOut(head_ + 4, length, body);
+    head_ += 4 + static_cast<uint64_t>(length);
+    scanned_ = head_;
+    return true;
+}
+
+void RecvBuffer::grow(size_t minFree) {
+    const size_t used = size();
+    const size_t newCap = roundUpToPowerOfTwo(std::max(buffer_.size() * 2, used + minFree));
+    std::vector<char> grown(newCap);
+
+    const size_t cap = buffer_.size();
+    const size_t headIdx = static_cast<size_t>(head_) & mask();
+    const size_t first = std::min(used, cap - headIdx);
+    std::memcpy(grown.data(), buffer_.data() + headIdx, first);
+    std::memcpy(grown.data() + first, buffer_.data(), used - first);
+
+    const uint64_t scannedOffset = scanned_ - head_;
+    buffer_.swap(grown);
+    head_ = 0;
+    tail_ = used;
+    scanned_ = scannedOffset;
+}
+
+void RecvBuffer::copyOut(uint64_t from, size_t length, std::string& out) const {
+    const size_t cap = buffer_.size();
+    const size_t idx = static_cast<size_t>(from) & mask();
+    const size_t first = std::min(length, cap - idx);
+    out.assign(buffer_.data() + idx, first);
+    out.append(buffer_.data(), length - first);
+}
@@ -0,0 +1,110 @@
+#include "secure_random.hpp"
+#include <sys/random.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+// "00".."ff", two characters per byte value.
+constexpr std::array<char, 512> makeHexPairs() {
+    const char digits[] = "0123456789abcdef";
+    std::array<char, 512> table{};
+    for (size_t i = 0; i < 256; ++i) {
+        table[i * 2] = digits[i >> 4];
+        table[i * 2 + 1] = digits[i & 0xF];
+    }
+    return table;
+}
+
+constexpr std::array<char, 512> kHexPairs = makeHexPairs();
+
+// Kernels before 3.17 have no getrandom(); /dev/urandom gives the same bytes.
+void readUrandom(unsigned char* out, size_t size) {
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("[SecureRandom] cannot open /dev/urandom");
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, out + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            close(fd);
+            throw std::runtime_error("[SecureRandom] read from /dev/urandom failed");
+        }
+        done += static_cast<size_t>(n);
+    }
+    close(fd);
+}
+
+void kernelRandom(unsigned char* out, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = getrandom(out + done, size - done, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOSYS) {
+                readUrandom(out + done, size - done);
+                return;
+            }
+            throw std::runtime_error("[SecureRandom] getrandom failed: " + std::string(std::strerror(errno)));
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+struct ThreadPool {
+    unsigned char bytes[SecureRandom::kBufferBytes];
+    size_t used = SecureRandom::kBufferBytes;
+};
+
+thread_local ThreadPool tPool;
+}
+
+void SecureRandom::fill(void* out, size_t size) {
+    unsigned char* dst = static_cast<unsigned char*>(out);
+    if (size >= kBufferBytes) {
+        kernelRandom(dst, size);
+        return;
+    }
+    while (size > 0) {
+        if (tPool.used == kBufferBytes) {
+            kernelRandom(tPool.bytes, kBufferBytes);
+            tPool.used = 0;
+        }
+        const size_t take = std::min(size, kBufferBytes - tPool.used);
+        std::memcpy(dst, tPool.bytes + tPool.used, take);
+        std::memset(tPool.bytes + tPool.used, 0, take);
+        tPool.used += take;
+        dst += take;
+        size -= take;
+    }
+}
+
+void SecureRandom::hex(char* out, size_t bytes) {
+    unsigned char raw[64];
+    while (bytes > 0) {
+        const size_t chunk = std::min(bytes, sizeof(raw));
+        fill(raw, chunk);
+        for (size_t i = 0; i < chunk; ++i) {
+            std::memcpy(out, &kHexPairs[raw[i] * 2u], 2);
+            out += 2;
+        }
+        bytes -= chunk;
+    }
+    std::memset(raw, 0, sizeof(raw));
+}
+
+std::string SecureRandom::hex(size_t bytes) {
+    std::string out(bytes * 2, '\0');
+    hex(&out[0], bytes);
+    return out;
+}
@@ -4,15 +4,13 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <cstring>
-#include <sstream>
 #include <cerrno>
-#include <sys/time.h>
 
 namespace {
 const char kBase64Chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-std::string base64Encode(const std::string& input) {
+std::string base64Encode(std::string_view input) {
     if (input.empty()) {
         return "";
     }
@@ -36,13 +34,188 @@ std::string base64Encode(const std::string& input) {
     }
     return out;
 }
+
+std::string base64Decode(const std::string& in) {
+    std::string out;
+    out.reserve(in.size() / 4 * 3);
+    int val = 0;
+    int bits = -8;
+    for (unsigned char c : in) {
+        int d;
+        if (c >= 'A' && c <= 'Z') d = c - 'A';
+        else if (c >= 'a' && c <= 'z') d = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') d = c - '0' + 52;
+        else if (c == '+') d = 62;
+        else if (c == '/') d = 63;
+        else break;
+        val = (val << 6) | d;
+        bits += 6;
+        if (bits >= 0) {
+            out.push_back(static_cast<char>((val >> bits) & 0xFF));
+            bits -= 8;
+        }
+    }
+    return out;
+}
+
+// base64Decode stops at the first character it does not know; input that
+// has to be exactly base64 is checked here first.
+bool isBase64(std::string_view in) {
+    if (in.size() % 4 != 0) {
+        return false;
+    }
+    size_t padding = 0;
+    while (padding < 2 && padding < in.size() && in[in.size() - 1 - padding] == '=') {
+        ++padding;
+    }
+    for (size_t i = 0; i < in.size() - padding; ++i) {
+        const char c = in[i];
+        if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+              c == '+' || c == '/')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Streamed text replies: the first piece leaves as soon as it is this big,
+// later pieces at kStreamChunkBytes. The worker never waits on the client:
+// pieces it cannot send yet are left for the event loop, and a client that
+// lets more than kStreamBacklogBytes pile up is dropped, which frees the
+// worker and its database connection straight away.
+const size_t kStreamFirstChunkBytes = 4 * 1024;
+const size_t kStreamChunkBytes = 64 * 1024;
+const size_t kStreamBacklogBytes = 4 * 1024 * 1024;
+
+// Writes one text response line in pieces while its rows are still being
+// read, so a large page is never held whole and its first bytes go out
+// before the last row arrives.
+class StreamedReply {
+public:
+    StreamedReply(const std::shared_ptr<Connection>& conn, const std::string& head,
+                  std::atomic<uint64_t>& slowDisconnects)
+        : conn_(conn), slowDisconnects_(slowDisconnects), buffer_(head), pushed_(false), failed_(false) {
+        conn_->beginStreamedResponse();
+    }
+
+    ~StreamedReply() {
+        conn_->endStreamedResponse();
+    }
+
+    std::string& buffer() { return buffer_; }
+
+    // Call after each row.
+    void rowDone() {
+        if (buffer_.size() >= (pushed_ ? kStreamChunkBytes : kStreamFirstChunkBytes)) {
+            push();
+        }
+    }
+
+    void finish() {
+        buffer_ += '\n';
+        push();
+    }
+
+    // Replaces the reply with an error while nothing has been sent; after
+    // that the line cannot be repaired and the connection is closed.
+    void fail(const std::string& error) {
+        if (!pushed_) {
+            buffer_.clear();
+            appendLineSafe(buffer_, error);
+            finish();
+            return;
+        }
+        std::cerr << "[Server] Streamed reply failed midway: " << error << std::endl;
+        abandon();
+    }
+
+private:
+    std::shared_ptr<Connection> conn_;
+    std::atomic<uint64_t>& slowDisconnects_;
+    std::string buffer_;
+    bool pushed_;
+    bool failed_;
+
+    void push() {
+        if (failed_) {
+            buffer_.clear();
+            return;
+        }
+        pushed_ = true;
+        conn_->queueFrame(std::move(buffer_));
+        buffer_ = std::string();
+        buffer_.reserve(kStreamChunkBytes + kStreamFirstChunkBytes);
+        if (!conn_->flush()) {
+            abandon();
+            return;
+        }
+        if (conn_->pendingOutputBytes() > kStreamBacklogBytes) {
+            std::cerr << "[Server] Dropping a client that stopped reading a streamed reply" << std::endl;
+            ++slowDisconnects_;
+            abandon();
+        }
+    }
+
+    void abandon() {
+        failed_ = true;
+        buffer_.clear();
+        conn_->markClosed();
+    }
+};
+
+// Binary replies must fit in kMaxFrameSize, which clients refuse to read
+// past. A page that would not fit ends early with one more u32 field naming
+// where to resume: AfterId for messages, Offset for the inbox.
+const size_t kContinuationBytes = FrameWriter::fieldSize(4);
+
+ServerConfig configForPort(int port) {
+    ServerConfig config;
+    config.port = port;
+    return config;
+}
+
+ReplicaRouter::Options replicaOptions(const ServerConfig& config) {
+    ReplicaRouter::Options options;
+    options.poolSize = static_cast<size_t>(std::max(1, config.dbPoolSize));
+    options.maxLagBytes = static_cast<uint64_t>(std::max(0, config.replicaMaxLagKb)) * 1024;
+    return options;
+}
 }
 
 MessengerServer::MessengerServer(const std::string& dbConnStr, int port)
-    : port_(port), serverSocket_(-1), running_(false), db_(dbConnStr) {
+    : MessengerServer(dbConnStr, configForPort(port)) {}
+
+MessengerServer::MessengerServer(const std::string& dbConnStr, const ServerConfig& config)
+    : config_(config), serverSocket_(-1), running_(false), nextLoop_(0),
+      eventsDropped_(0), slowConsumersDisconnected_(0),
+      workers_(static_cast<size_t>(std::max(1, config.workerThreads)),
+               static_cast<size_t>(std::max(1, config.maxQueuedJobs))),
+      db_(dbConnStr, static_cast<size_t>(std::max(1, config.dbPoolSize)), config.dbReplicas,
+          replicaOptions(config)),
+      sessionMgr_(std::chrono::seconds(std::max(1, config.sessionTtlSeconds)), config.sessionSecret),
+      userCache_(static_cast<size_t>(std::max(0, config.userCacheSize))) {
     if (!db_.isConnected()) {
         throw std::runtime_error("[Server] Failed to connect to database");
     }
+    if (config_.ioThreads < 1) {
+        config_.ioThreads = 1;
+    }
+    if (config_.acceptShards < 0) {
+        config_.acceptShards = 0;
+    }
+    if (config_.listenBacklog < 1) {
+        config_.listenBacklog = SOMAXCONN;
+    }
+    if (config_.maxQueuedEvents < 1) {
+        config_.maxQueuedEvents = 1;
+    }
+    if (config_.sendBatchSize > 1) {
+        sendBatcher_ = std::make_unique<MessageBatcher>(
+            db_, static_cast<size_t>(config_.sendBatchSize),
+            std::chrono::microseconds(std::max(0, config_.sendBatchDelayUs)));
+    }
+    readReceipts_ = std::make_unique<ReadReceiptWriter>(
+        db_, std::chrono::milliseconds(std::max(0, config_.readReceiptDelayMs)));
     std::cout << "[Server] Connected to database" << std::endl;
 }
 
@@ -50,39 +223,108 @@ MessengerServer::~MessengerServer() {
     stop();
 }
 
-void MessengerServer::start() {
-    if (running_) return;
-
-    serverSocket_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (serverSocket_ < 0) {
+int MessengerServer::openListener(bool reusePort) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
         throw std::runtime_error("[Server] Failed to create socket");
     }
 
     int opt = 1;
-    if (setsockopt(serverSocket_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        close(serverSocket_);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        close(fd);
         throw std::runtime_error("[Server] setsockopt failed");
     }
+    if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        close(fd);
+        throw std::runtime_error("[Server] SO_REUSEPORT not supported");
+    }
 
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port_);
+    addr.sin_port = htons(config_.port);
 
-    if (bind(serverSocket_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        close(serverSocket_);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
         throw std::runtime_error("[Server] Failed to bind socket");
     }
 
-    if (listen(serverSocket_, 5) < 0) {
-        close(serverSocket_);
+    if (listen(fd, config_.listenBacklog) < 0) {
+        close(fd);
         throw std::runtime_error("[Server] Failed to listen on socket");
     }
+    return fd;
+}
+
+void MessengerServer::start() {
+    if (running_) return;
+
+    const bool sharded = config_.acceptShards > 0;
+    const int loopCount = sharded ? config_.acceptShards : config_.ioThreads;
+
+    // Open every listener before any thread starts, so a bind failure leaves
+    // nothing running.
+    std::vector<int> listeners;
+    try {
+        if (sharded) {
+            for (int i = 0; i < loopCount; ++i) {
+                listeners.push_back(openListener(true));
+            }
+        } else {
+            serverSocket_ = openListener(false);
+        }
+    } catch (...) {
+        for (int fd : listeners) {
+            close(fd);
+        }
+        throw;
+    }
+
+    // Every shard gets its listener before any loop starts; a shard without
+    // one would run but never accept, so that fails startup instead.
+    for (int i = 0; i < loopCount; ++i) {
+        loops_.push_back(std::make_unique<EventLoop>(
+            [this](const std::shared_ptr<Connection>& conn, InboundRequest&& request) {
+                onRequest(conn, std::move(request));
+            },
+            [this](const std::shared_ptr<Connection>& conn) {
+                handleDisconnect(conn);
+            }));
+        if (sharded && !loops_.back()->addListener(listeners[i])) {
+            // Registered listeners are closed with their loops.
+            for (size_t j = i; j < listeners.size(); ++j) {
+                close(listeners[j]);
+            }
+            loops_.clear();
+            throw std::runtime_error("[Server] Failed to register listener for shard " + std::to_string(i));
+        }
+    }
+
+    workers_.start();
+
+    const int cpuCount = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < loopCount; ++i) {
+        loops_[i]->start();
+
+        if (config_.pinCpus) {
+            const int cpu = config_.cpus.empty() ? i % cpuCount
+                                                 : config_.cpus[i % config_.cpus.size()];
+            if (!loops_[i]->pinToCpu(cpu)) {
+                std::cerr << "[Server] Failed to pin I/O thread " << i << " to CPU " << cpu << std::endl;
+            }
+        }
+    }
 
     running_ = true;
-    acceptThread_ = std::thread(&MessengerServer::acceptConnections, this);
-    std::cout << "[Server] Started on port " << port_ << std::endl;
+    if (!sharded) {
+        acceptThread_ = std::thread(&MessengerServer::acceptConnections, this);
+    }
+    maintenanceThread_ = std::thread(&MessengerServer::runMaintenance, this);
+    std::cout << "[Server] Started on port " << config_.port
+              << " (" << loopCount << (sharded ? " SO_REUSEPORT shards, " : " I/O threads, ")
+              << workers_.threadCount() << " workers, backlog " << config_.listenBacklog
+              << (config_.pinCpus ? ", pinned" : "") << ")" << std::endl;
 }
 
 void MessengerServer::stop() {
@@ -98,15 +340,26 @@ void MessengerServer::stop() {
     if (acceptThread_.joinable()) {
         acceptThread_.join();
     }
-
     {
-        std::lock_guard<std::mutex> lock(threadsMutex_);
-        for (auto& t : clientThreads_) {
-            if (t.joinable()) {
-                t.join();
-            }
-        }
-        clientThreads_.clear();
+        // running_ is already false; taking the lock closes the gap between
+        // the maintenance thread's check and its wait.
+        std::lock_guard<std::mutex> lock(maintenanceMutex_);
+    }
+    maintenanceCv_.notify_all();
+    if (maintenanceThread_.joinable()) {
+        maintenanceThread_.join();
+    }
+
+    for (auto& loop : loops_) {
+        loop->stop();
+    }
+    workers_.stop();
+    loops_.clear();
+    if (sendBatcher_) {
+        sendBatcher_->stop();
+    }
+    if (readReceipts_) {
+        readReceipts_->stop();
     }
 
     std::cout << "[Server] Stopped" << std::endl;
@@ -116,6 +369,10 @@ bool MessengerServer::isRunning() const {
     return running_;
 }
 
+size_t MessengerServer::pendingJobs() const {
+    return workers_.queueDepth();
+}
+
 void MessengerServer::acceptConnections() {
     while (running_) {
         struct sockaddr_in clientAddr;
@@ -132,155 +389,179 @@ void MessengerServer::acceptConnections() {
         std::cout << "[Server] New client connection from " 
                   << inet_ntoa(clientAddr.sin_addr) << ":" << ntohs(clientAddr.sin_port) << std::endl;
 
-        {
-            std::lock_guard<std::mutex> lock(threadsMutex_);
-            clientThreads_.emplace_back(&MessengerServer::handleClient, this, clientSocket);
-        }
+        EventLoop& loop = *loops_[nextLoop_++ % loops_.size()];
+        loop.addConnection(clientSocket);
     }
 }
 
-void MessengerServer::handleClient(int clientSocket) {
-    bool subscribed = false;
-    timeval timeout;
-    timeout.tv_sec = 30;
-    timeout.tv_usec = 0;
-    if (setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-        std::cerr << "[Server] Failed to set receive timeout" << std::endl;
-    }
-    if (setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
-        std::cerr << "[Server] Failed to set send timeout" << std::endl;
-    }
+// Applies the retention setting, then keeps message partitions created ahead
+// of time and drops expired ones every partitionMaintenanceMinutes.
+void MessengerServer::runMaintenance() {
     try {
-        while (running_) {
-            std::string request = receiveMessage(clientSocket);
-            if (request.empty()) {
-                break;
-            }
-
-            std::cout << "[Server] Received: " << request << std::endl;
-
-            std::string cmd;
-            std::unordered_map<std::string, std::string> params;
-            parseCommand(request, cmd, params);
-
-            std::string response = "[ERROR] Unknown command";
+        db_.setMessageRetention(std::max(0, config_.messageRetentionDays));
+    } catch (const std::exception& e) {
+        std::cerr << "[Server] Failed to set message retention: " << e.what() << std::endl;
+    }
 
-            auto parseInt = [](const std::string& value, int fallback) {
-                if (value.empty()) return fallback;
-                try {
-                    return std::max(0, std::stoi(value));
-                } catch (...) {
-                    return fallback;
-                }
-            };
-
-            if (cmd == "REGISTER") {
-                response = handleRegister(params["username"], params["password"]);
-            } else if (cmd == "LOGIN") {
-                response = handleLogin(params["username"], params["password"]);
-            } else if (cmd == "LOGOUT") {
-                response = handleLogout(params["sessionId"]);
-            } else if (cmd == "SEND") {
-                response = handleSendMessage(params["sessionId"], params["to"], params["body"]);
-            } else if (cmd == "SEND_E2E") {
-                response = handleSendMessageE2e(params["sessionId"], params["to"], params["body"], params["e2e"], params["e2e_pub"]);
-            } else if (cmd == "GET_MESSAGES") {
-                const int limit = parseInt(params["limit"], 50);
-                const int offset = parseInt(params["offset"], 0);
-                response = handleGetMessages(params["sessionId"], params["contact"], limit, offset);
-            } else if (cmd == "GET_MESSAGES_E2E") {
-                const int limit = parseInt(params["limit"], 50);
-                const int offset = parseInt(params["offset"], 0);
-                response = handleGetMessages(params["sessionId"], params["contact"], limit, offset);
-            } else if (cmd == "GET_CHATS") {
-                response = handleGetChats(params["sessionId"]);
-            } else if (cmd == "GET_PROFILE") {
-                response = handleGetProfile(params["username"]);
-            } else if (cmd == "SET_AVATAR") {
-                response = handleSetAvatar(params["sessionId"], params["data"], params["mime"]);
-            } else if (cmd == "SET_E2E_PUB") {
-                response = handleSetE2ePub(params["sessionId"], params["pub"]);
-            } else if (cmd == "GET_INBOX") {
-                response = handleGetInbox(params["sessionId"]);
-            } else if (cmd == "DELETE_CHAT") {
-                response = handleDeleteChat(params["sessionId"], params["contact"]);
-            } else if (cmd == "SUBSCRIBE") {
-                response = handleSubscribe(params["sessionId"], clientSocket);
-                if (response.rfind("[OK]", 0) == 0) {
-                    subscribed = true;
-                }
+    const auto interval = std::chrono::minutes(std::max(1, config_.partitionMaintenanceMinutes));
+    std::unique_lock<std::mutex> lock(maintenanceMutex_);
+    while (running_) {
+        lock.unlock();
+        try {
+            PostgresDatabase::PartitionMaintenance result =
+                db_.maintainMessagePartitions(std::max(1, config_.partitionMonthsAhead));
+            if (result.created > 0 || result.dropped > 0) {
+                std::cout << "[Server] Message partitions: " << result.created << " created, "
+                          << result.dropped << " dropped" << std::endl;
             }
-
-            sendMessage(clientSocket, response);
+        } catch (const std::exception& e) {
+            std::cerr << "[Server] Partition maintenance failed: " << e.what() << std::endl;
         }
-    } catch (const std::exception& e) {
-        std::cerr << "[Server] Client error: " << e.what() << std::endl;
+        lock.lock();
+        maintenanceCv_.wait_for(lock, interval, [this] { return !running_; });
     }
+}
 
-    if (subscribed) {
-        unregisterSubscriber(clientSocket);
+void MessengerServer::onRequest(const std::shared_ptr<Connection>& conn, InboundRequest&& request) {
+    if (!conn->enqueueRequest(std::move(request))) {
+        // A worker already owns this connection and will pick the request up.
+        return;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(recvBuffersMutex_);
-        recvBuffers_.erase(clientSocket);
+    if (!workers_.trySubmit([this, conn] { processRequests(conn); })) {
+        std::vector<InboundRequest> dropped;
+        conn->cancelScheduling(dropped);
+        for (const auto& req : dropped) {
+            reply(conn, req.format, "[ERROR] Busy");
+        }
     }
-
-    close(clientSocket);
 }
 
-void MessengerServer::sendMessage(int sock, const std::string& response) {
-    std::string msg = response + "\n";
-    size_t totalSent = 0;
-    while (totalSent < msg.size()) {
-#ifdef MSG_NOSIGNAL
-        ssize_t sent = send(sock, msg.c_str() + totalSent, msg.size() - totalSent, MSG_NOSIGNAL);
-#else
-        ssize_t sent = send(sock, msg.c_str() + totalSent, msg.size() - totalSent, 0);
-#endif
-        if (sent <= 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            throw std::runtime_error("Failed to send message");
+void MessengerServer::processRequests(const std::shared_ptr<Connection>& conn) {
+    std::vector<InboundRequest> batch;
+    bool resumeReading = false;
+    while (conn->takeRequests(batch, resumeReading)) {
+        if (resumeReading) {
+            conn->loop()->resumeReading(conn);
+        }
+        for (const auto& request : batch) {
+            handleRequest(conn, request);
         }
-        totalSent += static_cast<size_t>(sent);
+        conn->flush();
+    }
+    // The peer hung up while these ran; the loop closes once they are sent.
+    if (conn->inputDone()) {
+        conn->loop()->requestFlush(conn);
     }
 }
 
-std::string MessengerServer::receiveMessage(int sock) {
-    const size_t maxMessageSize = 1024 * 1024;
-    std::string buffer;
-    {
-        std::lock_guard<std::mutex> lock(recvBuffersMutex_);
-        buffer = recvBuffers_[sock];
-    }
-
-    while (true) {
-        size_t newlinePos = buffer.find('\n');
-        if (newlinePos != std::string::npos) {
-            std::string line = buffer.substr(0, newlinePos);
-            buffer.erase(0, newlinePos + 1);
-            {
-                std::lock_guard<std::mutex> lock(recvBuffersMutex_);
-                recvBuffers_[sock] = buffer;
-            }
-            return line;
-        }
+void MessengerServer::reply(const std::shared_ptr<Connection>& conn, WireFormat format, std::string response) {
+    if (format == WireFormat::Binary) {
+        conn->queueFrame(FrameWriter(Opcode::Response).add(FieldId::Text, response).finish());
+    } else {
+        conn->queueResponse(std::move(response));
+    }
+}
 
-        char chunk[1024];
-        int n = recv(sock, chunk, sizeof(chunk), 0);
-        if (n <= 0) {
-            if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
-                continue;
-            }
-            return "";
+void MessengerServer::handleRequest(const std::shared_ptr<Connection>& conn, const InboundRequest& request) {
+    Command cmd;
+    if (request.format == WireFormat::Binary) {
+        if (!parseFrameCommand(request.data, cmd)) {
+            reply(conn, request.format, "[ERROR] Malformed frame");
+            return;
         }
+        std::cout << "[Server] Received: " << commandName(cmd.opcode) << " (binary)" << std::endl;
+    } else {
+        std::cout << "[Server] Received: " << request.data << std::endl;
+        parseTextCommand(request.data, cmd);
+    }
 
-        buffer.append(chunk, static_cast<size_t>(n));
-        if (buffer.size() > maxMessageSize) {
-            return "";
+    auto field = [&cmd](FieldId id) { return std::string(cmd.get(id)); };
+
+    std::string response;
+    switch (static_cast<Opcode>(cmd.opcode)) {
+    case Opcode::Register:
+        response = handleRegister(field(FieldId::Username), field(FieldId::Password));
+        break;
+    case Opcode::Login:
+        response = handleLogin(field(FieldId::Username), field(FieldId::Password));
+        break;
+    case Opcode::Logout:
+        response = handleLogout(field(FieldId::SessionId));
+        break;
+    case Opcode::Send:
+        response = handleSendMessage(field(FieldId::SessionId), field(FieldId::To), field(FieldId::Body));
+        break;
+    case Opcode::SendE2e:
+        response = handleSendMessageE2e(field(FieldId::SessionId), field(FieldId::To), request.format,
+                                        field(FieldId::E2e), field(FieldId::E2ePub));
+        break;
+    case Opcode::GetMessages:
+    case Opcode::GetMessagesE2e: {
+        MessagePage page;
+        page.limit = cmd.getInt(FieldId::Limit, 50);
+        page.offset = cmd.getInt(FieldId::Offset, 0);
+        page.cursor.beforeId = cmd.getInt(FieldId::BeforeId, 0);
+        page.cursor.afterId = cmd.getInt(FieldId::AfterId, 0);
+        if (request.format == WireFormat::Binary) {
+            conn->queueFrame(handleGetMessagesFrame(field(FieldId::SessionId), field(FieldId::Contact), page));
+        } else {
+            handleGetMessages(conn, field(FieldId::SessionId), field(FieldId::Contact), page);
+        }
+        return;
+    }
+    case Opcode::GetChats:
+        response = handleGetChats(field(FieldId::SessionId), cmd.get(FieldId::Order) == "recent");
+        break;
+    case Opcode::GetProfile:
+        response = handleGetProfile(field(FieldId::Username));
+        break;
+    case Opcode::GetAvatar:
+        if (request.format == WireFormat::Binary) {
+            conn->queueFrame(handleGetAvatarFrame(field(FieldId::Username), field(FieldId::Hash)));
+            return;
+        }
+        response = handleGetAvatar(field(FieldId::Username), field(FieldId::Hash));
+        break;
+    case Opcode::SetAvatar:
+        response = handleSetAvatar(field(FieldId::SessionId), request.format, field(FieldId::Data), field(FieldId::Mime));
+        break;
+    case Opcode::SetE2ePub:
+        response = handleSetE2ePub(field(FieldId::SessionId), field(FieldId::Pub));
+        break;
+    case Opcode::GetInbox:
+        handleGetInbox(conn, request.format, field(FieldId::SessionId),
+                       cmd.getInt(FieldId::Limit, 20), cmd.getInt(FieldId::Offset, 0));
+        return;
+    case Opcode::DeleteChat:
+        response = handleDeleteChat(field(FieldId::SessionId), field(FieldId::Contact));
+        break;
+    case Opcode::Subscribe:
+        response = handleSubscribe(field(FieldId::SessionId), conn);
+        break;
+    case Opcode::Stats:
+        response = handleStats();
+        break;
+    case Opcode::Proto:
+        if (isBinaryUpgradeRequest(request.data)) {
+            // The event loop already parses this connection as frames; the
+            // acknowledgement itself is the last text line we send.
+            conn->upgradeEvents(kBinaryUpgradeResponse);
+            return;
         }
+        response = "[ERROR] Unsupported protocol";
+        break;
+    default:
+        response = "[ERROR] Unknown command";
+        break;
+    }
+
+    reply(conn, request.format, std::move(response));
+}
+
+void MessengerServer::handleDisconnect(const std::shared_ptr<Connection>& conn) {
+    if (conn->isSubscribed()) {
+        unregisterSubscriber(conn);
     }
 }
 
@@ -290,8 +571,7 @@ std::string MessengerServer::handleRegister(const std::string& username, const s
     }
 
     try {
-        pqxx::result existing = db_.getUserByUsername(username);
-        if (!existing.empty()) {
+        if (lookupUserId(username) > 0) {
             return "[ERROR] User already exists";
         }
 
@@ -301,6 +581,7 @@ std::string MessengerServer::handleRegister(const std::string& username, const s
         if (userId <= 0) {
             return "[ERROR] Failed to create user";
         }
+        userCache_.insert(username, userId);
 
         std::string sessionId = sessionMgr_.createSession(userId, username);
         return "[OK] REGISTER:sessionId=" + sessionId + ":userId=" + std::to_string(userId);
@@ -340,7 +621,7 @@ std::string MessengerServer::handleLogout(const std::string& sessionId) {
 }
 
 std::string MessengerServer::handleSendMessage(const std::string& sessionId, const std::string& receiverUsername, const std::string& body) {
-    Session* session = sessionMgr_.getSession(sessionId);
+    std::shared_ptr<const Session> session = sessionMgr_.getSession(sessionId);
     if (!session) {
         return "[ERROR] Invalid session";
     }
@@ -348,12 +629,13 @@ std::string MessengerServer::handleSendMessage(const std::string& sessionId, con
     int senderId = session->getUserId();
     std::string senderUsername = session->getUsername();
     try {
-        pqxx::result receiverRes = db_.getUserByUsername(receiverUsername);
-        if (receiverRes.empty()) {
+        int receiverId = lookupUserId(receiverUsername);
+        if (receiverId <= 0) {
             return "[ERROR] User not found";
         }
-        int receiverId = receiverRes[0]["id"].as<int>();
-        int msgId = db_.insertMessage(senderId, receiverId, body);
+        // Returns once the row is committed, so the event below never
+        // announces a message that could still roll back.
+        int msgId = storeMessage(PostgresDatabase::NewMessage{senderId, receiverId, body, false, "", ""});
 
         const std::string event = "[EVENT] MESSAGE:from=" + senderUsername + 
                                   ":to=" + receiverUsername + ":body=" + body;
@@ -367,24 +649,30 @@ std::string MessengerServer::handleSendMessage(const std::string& sessionId, con
 std::string MessengerServer::handleSendMessageE2e(
     const std::string& sessionId,
     const std::string& receiverUsername,
-    const std::string& body,
+    WireFormat format,
     const std::string& e2ePayload,
     const std::string& e2ePub
 ) {
-    Session* session = sessionMgr_.getSession(sessionId);
+    std::shared_ptr<const Session> session = sessionMgr_.getSession(sessionId);
     if (!session) {
         return "[ERROR] Invalid session";
     }
+    // Binary frames carry the ciphertext as is; text lines carry base64,
+    // checked here so a bad row never reaches a shared insert batch.
+    if (format == WireFormat::Text && !isBase64(e2ePayload)) {
+        return "[ERROR] E2E payload is not valid base64";
+    }
 
     int senderId = session->getUserId();
     std::string senderUsername = session->getUsername();
     try {
-        pqxx::result receiverRes = db_.getUserByUsername(receiverUsername);
-        if (receiverRes.empty()) {
+        int receiverId = lookupUserId(receiverUsername);
+        if (receiverId <= 0) {
             return "[ERROR] User not found";
         }
-        int receiverId = receiverRes[0]["id"].as<int>();
-        int msgId = db_.insertMessageE2e(senderId, receiverId, "", e2ePayload, e2ePub);
+        int msgId = storeMessage(PostgresDatabase::NewMessage{
+            senderId, receiverId, "", true,
+            format == WireFormat::Text ? base64Decode(e2ePayload) : e2ePayload, e2ePub});
 
         const std::string event = "[EVENT] MESSAGE:from=" + senderUsername +
                       ":to=" + receiverUsername + ":body=";
@@ -395,54 +683,169 @@ std::string MessengerServer::handleSendMessageE2e(
     }
 }
 
-std::string MessengerServer::handleGetMessages(const std::string& sessionId, const std::string& contactUsername, int limit, int offset) {
-    Session* session = sessionMgr_.getSession(sessionId);
+int MessengerServer::lookupUserId(const std::string& username) {
+    int userId = 0;
+    if (userCache_.lookup(username, userId)) {
+        return userId;
+    }
+    pqxx::result res = db_.getUserByUsername(username);
+    if (res.empty()) {
+        return 0;
+    }
+    userId = res[0]["id"].as<int>();
+    userCache_.insert(username, userId);
+    return userId;
+}
+
+int MessengerServer::storeMessage(PostgresDatabase::NewMessage message) {
+    if (sendBatcher_) {
+        return sendBatcher_->insert(std::move(message));
+    }
+    if (message.e2e) {
+        return db_.insertMessageE2e(message.senderId, message.receiverId,
+                                    message.e2ePayload, message.e2ePub);
+    }
+    return db_.insertMessage(message.senderId, message.receiverId, message.body);
+}
+
+std::string MessengerServer::loadMessages(const std::string& sessionId, const std::string& contactUsername,
+                                          const MessagePage& page, const PostgresDatabase::MessageRowFn& onRow) {
+    std::shared_ptr<const Session> session = sessionMgr_.getSession(sessionId);
     if (!session) {
         return "[ERROR] Invalid session";
     }
 
     int userId = session->getUserId();
     try {
-        pqxx::result contactRes = db_.getUserByUsername(contactUsername);
-        if (contactRes.empty()) {
+        int contactId = lookupUserId(contactUsername);
+        if (contactId <= 0) {
             return "[ERROR] User not found";
         }
-        int contactId = contactRes[0]["id"].as<int>();
-        
-        // Combined operation: get messages and mark as read in single transaction
-        pqxx::result msgs = db_.getMessagesAndMarkRead(userId, contactId, limit, offset);
-        
-        std::string response = "[OK] Messages:";
-        for (auto row : msgs) {
-            std::string isRead = row["is_read"].as<bool>() ? "1" : "0";
-            std::string e2ePayloadRaw = row["e2e_payload"].is_null() ? "" : row["e2e_payload"].as<std::string>();
-            std::string e2ePayload = base64Encode(e2ePayloadRaw);
-            std::string e2ePub = row["e2e_pub"].is_null() ? "" : row["e2e_pub"].as<std::string>();
-            response += "|" + std::to_string(row["id"].as<int>()) + ":" + 
-                       std::to_string(row["sender_id"].as<int>()) + ":" + 
-                       isRead + ":" +
-                       row["body"].as<std::string>() + ":" + e2ePayload + ":" + e2ePub;
+
+        // The page stays read-only; receipts are written later, and only
+        // when it showed the reader something unread.
+        int lastUnread = 0;
+        auto track = [&](const PostgresDatabase::MessageRowView& row) {
+            if (row.senderId == contactId && !row.isRead) {
+                lastUnread = std::max(lastUnread, row.id);
+            }
+            onRow(row);
+        };
+
+        const bool hasCursor = page.cursor.beforeId > 0 || page.cursor.afterId > 0;
+        if (!hasCursor && page.offset > 0) {
+            db_.streamConversationPage(userId, contactId, page.limit, page.offset, track);
+        } else {
+            db_.streamMessagesBetween(userId, contactId, page.limit, page.cursor, track);
         }
-        return response;
+
+        if (lastUnread > 0) {
+            readReceipts_->markRead(userId, contactId, lastUnread);
+        }
+        return "";
     } catch (const std::exception& e) {
         return "[ERROR] " + std::string(e.what());
     }
 }
 
+// Text GET_MESSAGES is written straight from the row stream: each row is
+// serialized into the reply's current piece, which goes out once it fills.
+void MessengerServer::handleGetMessages(const std::shared_ptr<Connection>& conn, const std::string& sessionId,
+                                        const std::string& contactUsername, const MessagePage& page) {
+    StreamedReply streamed(conn, "[OK] Messages:", slowConsumersDisconnected_);
+    std::string error = loadMessages(sessionId, contactUsername, page,
+        [&streamed](const PostgresDatabase::MessageRowView& row) {
+            std::string& out = streamed.buffer();
+            out += '|';
+            out += std::to_string(row.id);
+            out += ':';
+            out += std::to_string(row.senderId);
+            out += row.isRead ? ":1:" : ":0:";
+            appendLineSafe(out, row.body);
+            out += ':';
+            if (row.e2ePayload) {
+                out += base64Encode(*row.e2ePayload);
+            }
+            out += ':';
+            if (row.e2ePub) {
+                appendLineSafe(out, *row.e2ePub);
+            }
+            streamed.rowDone();
+        });
+    if (!error.empty()) {
+        streamed.fail(error);
+        return;
+    }
+    streamed.finish();
+}
+
+// Binary form of GET_MESSAGES: one record per row, starting at its MessageId
+// field. Payloads go out as the stored bytes, without a base64 pass. The frame needs
+// its length up front, so it is still built whole, but from the row stream
+// rather than a materialized result. Rows come in ascending id order, so a
+// page cut short at kMaxFrameSize resumes with afterId set to the last row
+// sent. A row too large for any frame is skipped rather than stalling the
+// page.
+std::string MessengerServer::handleGetMessagesFrame(const std::string& sessionId, const std::string& contactUsername, const MessagePage& page) {
+    FrameWriter frame(Opcode::Response);
+    frame.add(FieldId::Text, std::string("[OK] Messages:"));
+    bool full = false;
+    bool empty = true;
+    int resumeAfter = 0;
+    std::string error = loadMessages(sessionId, contactUsername, page,
+        [&](const PostgresDatabase::MessageRowView& row) {
+            if (full) {
+                return;
+            }
+            const size_t rowBytes = FrameWriter::fieldSize(4) * 2 + FrameWriter::fieldSize(1) +
+                                    FrameWriter::fieldSize(row.body.size()) +
+                                    (row.e2ePayload ? FrameWriter::fieldSize(row.e2ePayload->size()) : 0) +
+                                    (row.e2ePub ? FrameWriter::fieldSize(row.e2ePub->size()) : 0);
+            if (frame.size() + rowBytes + kContinuationBytes > kMaxFrameSize) {
+                full = true;
+                if (empty) {
+                    std::cerr << "[Server] Message " << row.id << " does not fit in a frame; skipped" << std::endl;
+                    resumeAfter = row.id;
+                }
+                return;
+            }
+            const char isRead = row.isRead ? 1 : 0;
+            frame.addU32(FieldId::MessageId, static_cast<uint32_t>(row.id));
+            frame.addU32(FieldId::SenderId, static_cast<uint32_t>(row.senderId));
+            frame.add(FieldId::IsRead, &isRead, 1);
+            frame.add(FieldId::Body, row.body.data(), row.body.size());
+            if (row.e2ePayload) {
+                frame.add(FieldId::E2e, row.e2ePayload->data(), row.e2ePayload->size());
+            }
+            if (row.e2ePub) {
+                frame.add(FieldId::E2ePub, row.e2ePub->data(), row.e2ePub->size());
+            }
+            empty = false;
+            resumeAfter = row.id;
+        });
+    if (!error.empty()) {
+        return FrameWriter(Opcode::Response).add(FieldId::Text, error).finish();
+    }
+    if (full) {
+        frame.addU32(FieldId::AfterId, static_cast<uint32_t>(resumeAfter));
+    }
+    return frame.finish();
+}
+
 std::string MessengerServer::handleSearchUsers(const std::string& query) {
     // TODO: Implement fuzzy search
     return "[OK] Users:";
 }
 
-std::string MessengerServer::handleGetChats(const std::string& sessionId) {
-    Session* session = sessionMgr_.getSession(sessionId);
+std::string MessengerServer::handleGetChats(const std::string& sessionId, bool byRecency) {
+    std::shared_ptr<const Session> session = sessionMgr_.getSession(sessionId);
     if (!session) {
         return "[ERROR] Invalid session";
     }
 
     int userId = session->getUserId();
     try {
-        pqxx::result res = db_.getChatsWithUnreadCounts(userId);
+        pqxx::result res = db_.getChatsWithUnreadCounts(userId, byRecency);
         std::string response = "[OK] Chats:";
         for (auto row : res) {
             response += "|" + row["username"].as<std::string>() + ":" + row["unread_count"].as<std::string>();
@@ -459,46 +862,114 @@ std::string MessengerServer::handleGetProfile(const std::string& username) {
     }
 
     try {
-        pqxx::result res = db_.getUserAvatarByUsername(username);
+        int ownerId = lookupUserId(username);
+        if (ownerId <= 0) {
+            return "[ERROR] User not found";
+        }
+        pqxx::result res = db_.getUserProfile(ownerId, username);
         if (res.empty()) {
             return "[ERROR] User not found";
         }
 
-        std::string avatarB64 = res[0]["avatar_b64"].is_null() ? "" : res[0]["avatar_b64"].as<std::string>();
+        std::string avatarHash = res[0]["avatar_hash"].is_null() ? "" : res[0]["avatar_hash"].as<std::string>();
         std::string avatarMime = res[0]["avatar_mime"].is_null() ? "" : res[0]["avatar_mime"].as<std::string>();
         std::string e2ePub = res[0]["e2e_pub"].is_null() ? "" : res[0]["e2e_pub"].as<std::string>();
 
-        return "[OK] Profile:username=" + username + ":avatar_b64=" + avatarB64 + ":mime=" + avatarMime + ":e2e_pub=" + e2ePub;
+        return "[OK] Profile:username=" + username + ":avatar_hash=" + avatarHash + ":mime=" + avatarMime + ":e2e_pub=" + e2ePub;
+    } catch (const std::exception& e) {
+        return "[ERROR] " + std::string(e.what());
+    }
+}
+
+std::string MessengerServer::loadAvatar(const std::string& username, const std::string& cachedHash, AvatarReply& avatar) {
+    if (username.empty()) {
+        return "[ERROR] Username required";
+    }
+
+    try {
+        int ownerId = lookupUserId(username);
+        if (ownerId <= 0) {
+            return "[ERROR] User not found";
+        }
+        pqxx::result res = db_.getAvatar(ownerId, username, cachedHash);
+        if (res.empty()) {
+            return "[ERROR] User not found";
+        }
+
+        avatar.hash = res[0]["avatar_hash"].is_null() ? "" : res[0]["avatar_hash"].as<std::string>();
+        avatar.mime = res[0]["mime"].is_null() ? "" : res[0]["mime"].as<std::string>();
+        avatar.notModified = !avatar.hash.empty() && avatar.hash == cachedHash;
+        if (!res[0]["data"].is_null()) {
+            auto data = res[0]["data"].as<std::basic_string<std::byte>>();
+            avatar.data.assign(reinterpret_cast<const char*>(data.data()), data.size());
+        }
+        return "";
     } catch (const std::exception& e) {
         return "[ERROR] " + std::string(e.what());
     }
 }
 
-std::string MessengerServer::handleSetAvatar(const std::string& sessionId, const std::string& avatarB64, const std::string& avatarMime) {
-    Session* session = sessionMgr_.getSession(sessionId);
+// The client sends the hash it has cached, if any; the bytes are only sent
+// when the user's current avatar is a different one.
+std::string MessengerServer::handleGetAvatar(const std::string& username, const std::string& cachedHash) {
+    AvatarReply avatar;
+    std::string error = loadAvatar(username, cachedHash, avatar);
+    if (!error.empty()) {
+        return error;
+    }
+    if (avatar.notModified) {
+        return "[OK] AvatarNotModified:hash=" + avatar.hash;
+    }
+    return "[OK] Avatar:hash=" + avatar.hash + ":mime=" + avatar.mime + ":data=" + base64Encode(avatar.data);
+}
+
+// Binary form of GET_AVATAR: the image goes out as raw bytes in a Data field.
+std::string MessengerServer::handleGetAvatarFrame(const std::string& username, const std::string& cachedHash) {
+    AvatarReply avatar;
+    std::string error = loadAvatar(username, cachedHash, avatar);
+    if (!error.empty()) {
+        return FrameWriter(Opcode::Response).add(FieldId::Text, error).finish();
+    }
+    if (avatar.notModified) {
+        return FrameWriter(Opcode::Response).add(FieldId::Text, "[OK] AvatarNotModified:hash=" + avatar.hash).finish();
+    }
+    return FrameWriter(Opcode::Response)
+        .add(FieldId::Text, "[OK] Avatar:hash=" + avatar.hash + ":mime=" + avatar.mime)
+        .add(FieldId::Data, avatar.data)
+        .finish();
+}
+
+// Binary frames carry the image as raw bytes, text lines as base64.
+std::string MessengerServer::handleSetAvatar(const std::string& sessionId, WireFormat format,
+                                             const std::string& avatarData, const std::string& avatarMime) {
+    std::shared_ptr<const Session> session = sessionMgr_.getSession(sessionId);
     if (!session) {
         return "[ERROR] Invalid session";
     }
 
-    if (avatarB64.empty() || avatarMime.empty()) {
+    if (avatarData.empty() || avatarMime.empty()) {
         return "[ERROR] Avatar data required";
     }
+    if (format == WireFormat::Text && !isBase64(avatarData)) {
+        return "[ERROR] Avatar data is not valid base64";
+    }
 
     try {
-        db_.setUserAvatar(session->getUserId(), avatarB64, avatarMime);
+        PostgresDatabase::AvatarUpdate update = db_.updateAvatar(
+            session->getUserId(), format == WireFormat::Text ? base64Decode(avatarData) : avatarData, avatarMime);
         const std::string username = session->getUsername();
-        std::vector<int> partners = db_.getChatPartnerIds(session->getUserId());
-        partners.push_back(session->getUserId());
-        const std::string event = "[EVENT] AVATAR:username=" + username;
-        notifyUsers(partners, event);
-        return "[OK] AvatarUpdated";
+        update.partnerIds.push_back(session->getUserId());
+        // Partners that already hold this hash have nothing to fetch.
+        const std::string event = "[EVENT] AVATAR:username=" + username + ":hash=" + update.hash;
+        notifyUsers(update.partnerIds, event);
+        return "[OK] AvatarUpdated:hash=" + update.hash;
     } catch (const std::exception& e) {
         return "[ERROR] " + std::string(e.what());
     }
 }
 
 std::string MessengerServer::handleSetE2ePub(const std::string& sessionId, const std::string& e2ePub) {
-    Session* session = sessionMgr_.getSession(sessionId);
+    std::shared_ptr<const Session> session = sessionMgr_.getSession(sessionId);
     if (!session) {
         return "[ERROR] Invalid session";
     }
@@ -515,110 +986,201 @@ std::string MessengerServer::handleSetE2ePub(const std::string& sessionId, const
     }
 }
 
-std::string MessengerServer::handleGetInbox(const std::string& sessionId, int limit, int offset) {
-    Session* session = sessionMgr_.getSession(sessionId);
+void MessengerServer::handleGetInbox(const std::shared_ptr<Connection>& conn, WireFormat format,
+                                     const std::string& sessionId, int limit, int offset) {
+    std::shared_ptr<const Session> session = sessionMgr_.getSession(sessionId);
     if (!session) {
-        return "[ERROR] Invalid session";
+        reply(conn, format, "[ERROR] Invalid session");
+        return;
     }
 
+    auto appendRow = [](std::string& out, const PostgresDatabase::InboxRowView& row) {
+        out += '|';
+        out += std::to_string(row.id);
+        out += ':';
+        out += std::to_string(row.senderId);
+        out += ':';
+        appendLineSafe(out, row.body);
+    };
+
     int userId = session->getUserId();
-    try {
-        pqxx::result msgs = db_.getInbox(userId, limit, offset);
+    if (format == WireFormat::Binary) {
+        // The rows share one Text field, cut short at kMaxFrameSize like
+        // binary GET_MESSAGES; the page resumes at offset + rows taken.
+        const size_t maxText = kMaxFrameSize - 1 - FrameWriter::fieldSize(0) - kContinuationBytes;
         std::string response = "[OK] Inbox:";
-        for (auto row : msgs) {
-            response += "|" + std::to_string(row["id"].as<int>()) + ":" + 
-                       std::to_string(row["sender_id"].as<int>()) + ":" + 
-                       row["body"].as<std::string>();
+        bool full = false;
+        int taken = 0;
+        try {
+            db_.streamInbox(userId, limit, offset, [&](const PostgresDatabase::InboxRowView& row) {
+                if (full) {
+                    return;
+                }
+                const size_t before = response.size();
+                appendRow(response, row);
+                if (response.size() > maxText) {
+                    response.resize(before);
+                    full = true;
+                    if (taken == 0) {
+                        std::cerr << "[Server] Inbox row " << row.id << " does not fit in a frame; skipped" << std::endl;
+                        taken = 1;
+                    }
+                    return;
+                }
+                ++taken;
+            });
+        } catch (const std::exception& e) {
+            reply(conn, format, "[ERROR] " + std::string(e.what()));
+            return;
         }
-        return response;
+        FrameWriter frame(Opcode::Response);
+        frame.add(FieldId::Text, response);
+        if (full) {
+            frame.addU32(FieldId::Offset, static_cast<uint32_t>(offset + taken));
+        }
+        conn->queueFrame(frame.finish());
+        return;
+    }
+
+    StreamedReply streamed(conn, "[OK] Inbox:", slowConsumersDisconnected_);
+    try {
+        db_.streamInbox(userId, limit, offset, [&](const PostgresDatabase::InboxRowView& row) {
+            appendRow(streamed.buffer(), row);
+            streamed.rowDone();
+        });
     } catch (const std::exception& e) {
-        return "[ERROR] " + std::string(e.what());
+        streamed.fail("[ERROR] " + std::string(e.what()));
+        return;
     }
+    streamed.finish();
 }
 
-std::string MessengerServer::handleSubscribe(const std::string& sessionId, int clientSocket) {
-    Session* session = sessionMgr_.getSession(sessionId);
+std::string MessengerServer::handleSubscribe(const std::string& sessionId, const std::shared_ptr<Connection>& conn) {
+    std::shared_ptr<const Session> session = sessionMgr_.getSession(sessionId);
     if (!session) {
         return "[ERROR] Invalid session";
     }
 
-    registerSubscriber(clientSocket, session->getUserId());
+    registerSubscriber(conn, session->getUserId());
     return "[OK] SUBSCRIBED";
 }
 
-void MessengerServer::registerSubscriber(int clientSocket, int userId) {
+std::string MessengerServer::handleStats() {
+    const PostgresConnectionPool::Stats pool = db_.poolStats();
+    const uint64_t avgWaitMicros = pool.waits ? pool.totalWaitMicros / pool.waits : 0;
+    const MessageBatcher::Stats batch = sendBatcher_ ? sendBatcher_->stats() : MessageBatcher::Stats{0, 0, 0, 0};
+    const UserCache::Stats users = userCache_.stats();
+    const SessionManager::Stats sessions = sessionMgr_.stats();
+    const ReadReceiptWriter::Stats receipts = readReceipts_->stats();
+    const ReplicaRouter::Stats replicas = db_.replicaStats();
+    return "[OK] Stats:queue_depth=" + std::to_string(workers_.queueDepth()) +
+           ":queue_capacity=" + std::to_string(workers_.queueCapacity()) +
+           ":rejected=" + std::to_string(workers_.rejectedCount()) +
+           ":db_pool_size=" + std::to_string(pool.size) +
+           ":db_pool_idle=" + std::to_string(pool.idle) +
+           ":db_checkouts=" + std::to_string(pool.checkouts) +
+           ":db_waits=" + std::to_string(pool.waits) +
+           ":db_wait_avg_us=" + std::to_string(avgWaitMicros) +
+           ":db_wait_max_us=" + std::to_string(pool.maxWaitMicros) +
+           ":db_timeouts=" + std::to_string(pool.timeouts) +
+           ":db_reconnects=" + std::to_string(pool.reconnects) +
+           ":events_dropped=" + std::to_string(eventsDropped_.load()) +
+           ":slow_disconnects=" + std::to_string(slowConsumersDisconnected_.load()) +
+           ":send_batches=" + std::to_string(batch.batches) +
+           ":send_batch_rows=" + std::to_string(batch.rows) +
+           ":send_batch_max=" + std::to_string(batch.largestBatch) +
+           ":send_batch_failures=" + std::to_string(batch.failedBatches) +
+           ":db_replicas=" + std::to_string(replicas.replicas) +
+           ":db_replicas_usable=" + std::to_string(replicas.usable) +
+           ":db_replica_reads=" + std::to_string(replicas.replicaReads) +
+           ":db_primary_reads=" + std::to_string(replicas.primaryReads) +
+           ":db_replica_lag_fallbacks=" + std::to_string(replicas.lagFallbacks) +
+           ":read_receipts=" + std::to_string(receipts.recorded) +
+           ":read_receipt_flushes=" + std::to_string(receipts.flushes) +
+           ":read_receipt_failures=" + std::to_string(receipts.failedFlushes) +
+           ":messages_marked_read=" + std::to_string(receipts.marked) +
+           ":user_cache_hits=" + std::to_string(users.hits) +
+           ":user_cache_misses=" + std::to_string(users.misses) +
+           ":user_cache_evictions=" + std::to_string(users.evictions) +
+           ":user_cache_size=" + std::to_string(users.size) +
+           ":sessions_active=" + std::to_string(sessions.active) +
+           ":sessions_created=" + std::to_string(sessions.created) +
+           ":sessions_expired=" + std::to_string(sessions.reaped) +
+           ":sessions_revoked=" + std::to_string(sessions.revoked);
+}
+
+void MessengerServer::registerSubscriber(const std::shared_ptr<Connection>& conn, int userId) {
     std::lock_guard<std::mutex> lock(subscribersMutex_);
-    socketToUser_[clientSocket] = userId;
-    userToSockets_[userId].insert(clientSocket);
+    auto it = socketToUser_.find(conn->fd());
+    if (it != socketToUser_.end() && it->second != userId) {
+        auto userIt = userToConnections_.find(it->second);
+        if (userIt != userToConnections_.end()) {
+            userIt->second.erase(conn->fd());
+            if (userIt->second.empty()) {
+                userToConnections_.erase(userIt);
+            }
+        }
+    }
+    socketToUser_[conn->fd()] = userId;
+    userToConnections_[userId][conn->fd()] = conn;
+    conn->setSubscribed(true);
 }
 
-void MessengerServer::unregisterSubscriber(int clientSocket) {
+void MessengerServer::unregisterSubscriber(const std::shared_ptr<Connection>& conn) {
     std::lock_guard<std::mutex> lock(subscribersMutex_);
-    auto it = socketToUser_.find(clientSocket);
+    auto it = socketToUser_.find(conn->fd());
     if (it == socketToUser_.end()) return;
     int userId = it->second;
     socketToUser_.erase(it);
 
-    auto userIt = userToSockets_.find(userId);
-    if (userIt != userToSockets_.end()) {
-        userIt->second.erase(clientSocket);
+    auto userIt = userToConnections_.find(userId);
+    if (userIt != userToConnections_.end()) {
+        userIt->second.erase(conn->fd());
         if (userIt->second.empty()) {
-            userToSockets_.erase(userIt);
+            userToConnections_.erase(userIt);
         }
     }
+    conn->setSubscribed(false);
 }
 
 void MessengerServer::notifyUsers(const std::vector<int>& userIds, const std::string& payload) {
-    std::lock_guard<std::mutex> lock(subscribersMutex_);
-    std::vector<int> socketsToRemove;
-
-    for (int userId : userIds) {
-        auto it = userToSockets_.find(userId);
-        if (it == userToSockets_.end()) continue;
-
-        for (int sock : it->second) {
-            std::string msg = payload + "\n";
-            size_t totalSent = 0;
-            bool failed = false;
-            while (totalSent < msg.size()) {
-#ifdef MSG_NOSIGNAL
-                ssize_t sent = send(sock, msg.c_str() + totalSent, msg.size() - totalSent, MSG_NOSIGNAL);
-#else
-                ssize_t sent = send(sock, msg.c_str() + totalSent, msg.size() - totalSent, 0);
-#endif
-                if (sent <= 0) {
-                    if (errno == EINTR) {
-                        continue;
-                    }
-                    failed = true;
-                    break;
-                }
-                totalSent += static_cast<size_t>(sent);
-            }
-            if (failed) {
-                socketsToRemove.push_back(sock);
+    std::vector<std::shared_ptr<Connection>> targets;
+    {
+        std::lock_guard<std::mutex> lock(subscribersMutex_);
+        for (int userId : userIds) {
+            auto it = userToConnections_.find(userId);
+            if (it == userToConnections_.end()) continue;
+            for (auto& entry : it->second) {
+                targets.push_back(entry.second);
             }
         }
     }
+    if (targets.empty()) {
+        return;
+    }
 
-    for (int sock : socketsToRemove) {
-        auto it = socketToUser_.find(sock);
-        if (it == socketToUser_.end()) continue;
-        int userId = it->second;
-        socketToUser_.erase(it);
-
-        auto userIt = userToSockets_.find(userId);
-        if (userIt != userToSockets_.end()) {
-            userIt->second.erase(sock);
-            if (userIt->second.empty()) {
-                userToSockets_.erase(userIt);
-            }
+    // Each subscriber has its own bounded queue that its event loop drains,
+    // so a stalled client cannot hold up the sender or anyone else.
+    auto shared = std::make_shared<const std::string>(payload);
+    for (auto& conn : targets) {
+        switch (conn->queueEvent(shared, static_cast<size_t>(config_.maxQueuedEvents), config_.slowConsumerPolicy)) {
+        case Connection::EventStatus::Queued:
+            break;
+        case Connection::EventStatus::DroppedOldest:
+            ++eventsDropped_;
+            break;
+        case Connection::EventStatus::Overflow:
+            ++slowConsumersDisconnected_;
+            std::cerr << "[Server] Disconnecting slow subscriber" << std::endl;
+            conn->markClosed();
+            continue;
         }
+        conn->loop()->requestFlush(conn);
     }
 }
 
 std::string MessengerServer::handleDeleteChat(const std::string& sessionId, const std::string& contactUsername) {
-    Session* session = sessionMgr_.getSession(sessionId);
+    std::shared_ptr<const Session> session = sessionMgr_.getSession(sessionId);
     if (!session) {
         return "[ERROR] Invalid session";
     }
@@ -629,43 +1191,13 @@ std::string MessengerServer::handleDeleteChat(const std::string& sessionId, cons
 
     int userId = session->getUserId();
     try {
-        pqxx::result contactRes = db_.getUserByUsername(contactUsername);
-        if (contactRes.empty()) {
+        int contactId = lookupUserId(contactUsername);
+        if (contactId <= 0) {
             return "[ERROR] User not found";
         }
-        int contactId = contactRes[0]["id"].as<int>();
         int removed = db_.deleteChatMessages(userId, contactId);
         return "[OK] ChatDeleted:count=" + std::to_string(removed);
     } catch (const std::exception& e) {
         return "[ERROR] " + std::string(e.what());
     }
 }
-
-bool MessengerServer::parseCommand(const std::string& data, std::string& cmd, 
-                                    std::unordered_map<std::string, std::string>& params) {
-    std::istringstream iss(data);
-    iss >> cmd;
-    
-    std::string pair;
-    while (iss >> pair) {
-        size_t eqPos = pair.find('=');
-        if (eqPos != std::string::npos) {
-            std::string key = pair.substr(0, eqPos);
-            std::string value = pair.substr(eqPos + 1);
-
-            if (key == "body") {
-                std::string rest;
-                std::getline(iss, rest);
-                if (!rest.empty() && rest.front() == ' ') {
-                    rest.erase(0, 1);
-                }
-                if (!rest.empty()) {
-                    value += " " + rest;
-                }
-            }
-
-            params[key] = value;
-        }
-    }
-    return true;
-}
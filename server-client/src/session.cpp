@@ -1,56 +1,151 @@
 #include "session.hpp"
-#include <random>
-#include <sstream>
-#include <iomanip>
+#include "secure_random.hpp"
+#include <algorithm>
+#include <functional>
+#include <utility>
 
-std::string SessionManager::generateSessionId() {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 15);
+SessionManager::SessionManager(std::chrono::seconds ttl, std::string tokenSecret)
+    : ttl_(ttl),
+      tick_(std::max<Clock::duration>(std::chrono::seconds(1), ttl / kWheelSlots)),
+      epoch_(Clock::now()),
+      tokens_(std::move(tokenSecret)),
+      created_(0), reaped_(0), running_(true) {
+    reaper_ = std::thread(&SessionManager::reap, this);
+}
 
-    std::stringstream ss;
-    for (int i = 0; i < 32; i++) {
-        ss << std::hex << dis(gen);
+SessionManager::~SessionManager() {
+    {
+        std::lock_guard<std::mutex> lock(reaperMutex_);
+        running_ = false;
+    }
+    reaperCv_.notify_all();
+    if (reaper_.joinable()) {
+        reaper_.join();
     }
-    return ss.str();
 }
 
-std::string SessionManager::createSession(int userId, const std::string& username) {
-    std::string sessionId = generateSessionId();
-    sessions_[sessionId] = new Session(userId, username, sessionId);
-    return sessionId;
+SessionManager::Shard& SessionManager::shardFor(const std::string& sessionId) {
+    return shards_[std::hash<std::string>{}(sessionId) % kShards];
 }
 
-bool SessionManager::verifySession(const std::string& sessionId) {
-    auto it = sessions_.find(sessionId);
-    if (it == sessions_.end()) {
-        return false;
+size_t SessionManager::slotFor(Clock::time_point when) const {
+    return static_cast<size_t>((when - epoch_) / tick_) % kWheelSlots;
+}
+
+// 128 random bits as 32 hex digits.
+std::string SessionManager::generateSessionId() {
+    return SecureRandom::hex(16);
+}
+
+std::string SessionManager::createSession(int userId, const std::string& username) {
+    if (tokens_.enabled()) {
+        created_++;
+        // The nonce keeps two logins in the same second apart, so logging
+        // out of one does not revoke the other.
+        return tokens_.issue(userId, username, SessionTokens::Clock::now() + ttl_,
+                             SecureRandom::hex(8));
     }
-    if (it->second->isExpired()) {
-        delete it->second;
-        sessions_.erase(it);
-        return false;
+
+    const Clock::time_point expiresAt = Clock::now() + ttl_;
+    while (true) {
+        std::string sessionId = generateSessionId();
+        Shard& shard = shardFor(sessionId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto inserted = shard.sessions.emplace(
+            sessionId, Entry{std::make_shared<const Session>(userId, username, sessionId), expiresAt});
+        if (!inserted.second) {
+            continue;
+        }
+        shard.wheel[slotFor(expiresAt)].push_back(sessionId);
+        created_++;
+        return sessionId;
     }
-    return true;
 }
 
-Session* SessionManager::getSession(const std::string& sessionId) {
-    auto it = sessions_.find(sessionId);
-    if (it == sessions_.end()) {
+bool SessionManager::verifySession(const std::string& sessionId) {
+    return getSession(sessionId) != nullptr;
+}
+
+std::shared_ptr<const Session> SessionManager::getSession(const std::string& sessionId) {
+    if (SessionTokens::isToken(sessionId)) {
+        SessionTokens::Claims claims;
+        if (!tokens_.verify(sessionId, claims)) {
+            return nullptr;
+        }
+        return std::make_shared<const Session>(claims.userId, claims.username, sessionId);
+    }
+
+    Shard& shard = shardFor(sessionId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(sessionId);
+    if (it == shard.sessions.end()) {
         return nullptr;
     }
-    if (it->second->isExpired()) {
-        delete it->second;
-        sessions_.erase(it);
+    if (it->second.expiresAt <= Clock::now()) {
+        // Its wheel slot still names it; the reaper skips ids it cannot find.
+        shard.sessions.erase(it);
+        reaped_++;
         return nullptr;
     }
-    return it->second;
+    return it->second.session;
 }
 
 void SessionManager::removeSession(const std::string& sessionId) {
-    auto it = sessions_.find(sessionId);
-    if (it != sessions_.end()) {
-        delete it->second;
-        sessions_.erase(it);
+    if (SessionTokens::isToken(sessionId)) {
+        tokens_.revoke(sessionId);
+        return;
+    }
+
+    Shard& shard = shardFor(sessionId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.sessions.erase(sessionId);
+}
+
+SessionManager::Stats SessionManager::stats() const {
+    size_t active = 0;
+    for (const Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        active += shard.sessions.size();
+    }
+    return Stats{active, created_.load(), reaped_.load(), tokens_.revokedCount()};
+}
+
+// Tick n covers [epoch + n*tick, epoch + (n+1)*tick). Once it has passed,
+// every session filed in its slot for this turn of the wheel has expired;
+// ids filed for a later turn stay where they are.
+void SessionManager::reap() {
+    uint64_t tick = 0;
+    std::unique_lock<std::mutex> lock(reaperMutex_);
+    while (running_) {
+        if (reaperCv_.wait_until(lock, epoch_ + tick_ * static_cast<Clock::rep>(tick + 1),
+                                 [this] { return !running_; })) {
+            break;
+        }
+        lock.unlock();
+
+        const size_t slot = static_cast<size_t>(tick % kWheelSlots);
+        std::vector<std::string> due;
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> shardLock(shard.mutex);
+            due.swap(shard.wheel[slot]);
+            const Clock::time_point now = Clock::now();
+            for (std::string& sessionId : due) {
+                auto it = shard.sessions.find(sessionId);
+                if (it == shard.sessions.end()) {
+                    continue;
+                }
+                if (it->second.expiresAt <= now) {
+                    shard.sessions.erase(it);
+                    reaped_++;
+                } else {
+                    shard.wheel[slot].push_back(std::move(sessionId));
+                }
+            }
+            due.clear();
+        }
+        tokens_.purgeRevoked();
+
+        ++tick;
+        lock.lock();
     }
 }
@@ -59,6 +59,17 @@ int main() {
     std::string msgsResp = client.getMessages("bob", 50, 0);
     std::cout << "Response: " << msgsResp << std::endl;
 
+    // Test 6b: Page back from the newest message with a keyset cursor
+    std::cout << "\n[Test 6b] Alice pages back through messages with bob" << std::endl;
+    std::vector<MessageRecord> page;
+    std::string pageResp = client.getMessages("bob", page, MessageCursor(), 1);
+    std::cout << "Response: " << pageResp << std::endl;
+    if (!page.empty()) {
+        MessageCursor older;
+        older.beforeId = page.front().id;
+        std::cout << "Older page: " << client.getMessages("bob", older, 50) << std::endl;
+    }
+
     // Test 7: Logout
     std::cout << "\n[Test 7] Alice logout" << std::endl;
     std::string logoutResp = client.logout();
@@ -0,0 +1,76 @@
+#include "user_cache.hpp"
+#include <functional>
+
+UserCache::UserCache(size_t capacity)
+    : capacity_(capacity),
+      shardCapacity_(capacity > 0 ? (capacity + kShards - 1) / kShards : 0),
+      hits_(0), misses_(0), evictions_(0) {}
+
+UserCache::Shard& UserCache::shardFor(const std::string& username) {
+    return shards_[std::hash<std::string>{}(username) % kShards];
+}
+
+bool UserCache::lookup(const std::string& username, int& userId) {
+    if (!enabled()) {
+        misses_++;
+        return false;
+    }
+
+    Shard& shard = shardFor(username);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(username);
+    if (it == shard.index.end()) {
+        misses_++;
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    userId = it->second->second;
+    hits_++;
+    return true;
+}
+
+void UserCache::insert(const std::string& username, int userId) {
+    if (!enabled()) {
+        return;
+    }
+
+    Shard& shard = shardFor(username);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(username);
+    if (it != shard.index.end()) {
+        it->second->second = userId;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+
+    if (shard.lru.size() >= shardCapacity_) {
+        shard.index.erase(shard.lru.back().first);
+        shard.lru.pop_back();
+        evictions_++;
+    }
+    shard.lru.emplace_front(username, userId);
+    shard.index.emplace(username, shard.lru.begin());
+}
+
+void UserCache::invalidate(const std::string& username) {
+    if (!enabled()) {
+        return;
+    }
+
+    Shard& shard = shardFor(username);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(username);
+    if (it != shard.index.end()) {
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+}
+
+UserCache::Stats UserCache::stats() const {
+    size_t size = 0;
+    for (const Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        size += shard.lru.size();
+    }
+    return Stats{hits_.load(), misses_.load(), evictions_.load(), size, capacity_};
+}
@@ -0,0 +1,76 @@
+#include "worker_pool.hpp"
+#include <iostream>
+
+WorkerPool::WorkerPool(size_t threadCount, size_t maxQueuedJobs)
+    : threadCount_(threadCount > 0 ? threadCount : 1),
+      maxQueuedJobs_(maxQueuedJobs > 0 ? maxQueuedJobs : 1),
+      running_(false), rejected_(0) {}
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+void WorkerPool::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) return;
+    running_ = true;
+    for (size_t i = 0; i < threadCount_; ++i) {
+        threads_.emplace_back(&WorkerPool::run, this);
+    }
+}
+
+void WorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) return;
+        running_ = false;
+    }
+    cv_.notify_all();
+
+    for (auto& t : threads_) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    threads_.clear();
+    jobs_.clear();
+}
+
+bool WorkerPool::trySubmit(Job job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_ || jobs_.size() >= maxQueuedJobs_) {
+            ++rejected_;
+            return false;
+        }
+        jobs_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+    return true;
+}
+
+size_t WorkerPool::queueDepth() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jobs_.size();
+}
+
+void WorkerPool::run() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return !running_ || !jobs_.empty(); });
+            if (!running_) {
+                return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+
+        try {
+            job();
+        } catch (const std::exception& e) {
+            std::cerr << "[Server.Workers] Job failed: " << e.what() << std::endl;
+        }
+    }
+}